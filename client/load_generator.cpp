@@ -12,14 +12,31 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <cstring>
+#include <cstdio>
 #include <cmath>
 #include <algorithm>
 #include <ctime>
+#include <charconv>
 
 const std::string HOST = "127.0.0.1";
 const int PORT = 8080;
 std::atomic<bool> stop_flag{false};
 
+// --protocol binary: speak the server's length-prefixed protocol (see
+// include/binary_protocol.h) on --port instead of HTTP
+int server_port = PORT;
+bool binary_protocol = false;
+
+// The whole of s as an int no smaller than min; false on anything else.
+bool parse_int(const char* s, int min, int& out) {
+    const char* end = s + std::strlen(s);
+    int v = 0;
+    auto r = std::from_chars(s, end, v);
+    if (r.ec != std::errc() || r.ptr != end || r.ptr == s || v < min) return false;
+    out = v;
+    return true;
+}
+
 struct Metrics {
     std::atomic<long long> total_requests{0};
     std::atomic<long long> successful_requests{0};
@@ -28,6 +45,9 @@ struct Metrics {
     std::atomic<int> cache_hits{0};
     std::atomic<int> cache_misses{0};
     std::atomic<int> get_requests{0};
+    std::atomic<long long> send_calls{0};
+    std::atomic<long long> recv_calls{0};
+    std::atomic<long long> keys_done{0};   // keys read or written by successful requests
     std::vector<long long> latencies_us;
     std::mutex latency_mutex;
     
@@ -74,7 +94,7 @@ public:
         
         sockaddr_in addr{};
         addr.sin_family = AF_INET;
-        addr.sin_port = htons(PORT);
+        addr.sin_port = htons(server_port);
         inet_pton(AF_INET, HOST.c_str(), &addr.sin_addr);
         
         if (::connect(fd_, (sockaddr*)&addr, sizeof(addr)) < 0) {
@@ -91,14 +111,41 @@ public:
             close(fd_);
             fd_ = -1;
         }
+        pending_.clear();
     }
     
-    bool send_request(const std::string& method, const std::string& path, 
-                     const std::string& body, std::string& response) {
+    // Sends every request with one send() and reads back one response per
+    // request. With a single request this is a plain keep-alive round trip.
+    bool send_batch(const std::vector<std::string>& reqs, std::vector<std::string>& responses) {
         if (fd_ < 0 && !connect()) {
             return false;
         }
-        
+
+        std::string out;
+        for (const auto& r : reqs) out += r;
+
+        size_t off = 0;
+        while (off < out.size()) {
+            ssize_t sent = send(fd_, out.data() + off, out.size() - off, MSG_NOSIGNAL);
+            syscalls_send++;
+            if (sent < 0) {
+                close_connection();
+                return false;
+            }
+            off += sent;
+        }
+
+        responses.clear();
+        while (responses.size() < reqs.size()) {
+            std::string response;
+            if (!read_response(response)) return false;
+            responses.push_back(std::move(response));
+        }
+        return true;
+    }
+
+    static std::string build_request(const std::string& method, const std::string& path,
+                                     const std::string& body) {
         // Build HTTP request with keep-alive
         std::string req = method + " " + path + " HTTP/1.1\r\n";
         req += "Host: " + HOST + "\r\n";
@@ -107,83 +154,185 @@ public:
             req += "Content-Length: " + std::to_string(body.size()) + "\r\n";
         }
         req += "\r\n" + body;
-        
-        // Send request
-        ssize_t sent = send(fd_, req.data(), req.size(), MSG_NOSIGNAL);
-        if (sent < 0) {
-            close_connection();
-            return false;
+        return req;
+    }
+
+    // The same request in binary framing: op:u8 key_len:u16 body_len:u32
+    // key body. Only /kv/<key> GET/PUT/DELETE and /_mget map onto it.
+    static std::string build_binary(const std::string& method, const std::string& path,
+                                    const std::string& body) {
+        std::string key = path.substr(0, 4) == "/kv/" ? path.substr(4) : "";
+        std::string payload = method == "PUT" ? body : "";
+        uint8_t op = method == "GET" ? 1 : method == "PUT" ? 2 : 3;
+        if (path == "/_mget") {
+            op = 4;
+            size_t pos = 0;
+            while (pos < body.size()) {
+                size_t nl = body.find('\n', pos);
+                if (nl == std::string::npos) nl = body.size();
+                std::string k = body.substr(pos, nl - pos);
+                payload += char(k.size() >> 8);
+                payload += char(k.size());
+                payload += k;
+                pos = nl + 1;
+            }
         }
-        
-        // Receive response
-        response.clear();
+        std::string req(1, char(op));
+        req += char(key.size() >> 8);
+        req += char(key.size());
+        for (int shift = 24; shift >= 0; shift -= 8) req += char(payload.size() >> shift);
+        return req + key + payload;
+    }
+
+    long long syscalls_send = 0;
+    long long syscalls_recv = 0;
+
+private:
+    int fd_;
+    std::string pending_;   // bytes received past the last full response
+
+    // Cuts the next complete response (by Content-Length, or up to the last
+    // chunk of a chunked body, or by the binary length prefix) off pending_,
+    // reading more only when it does not hold one yet.
+    bool read_response(std::string& response) {
         char buf[8192];
-        size_t content_length = 0;
-        bool headers_complete = false;
-        size_t header_end_pos = 0;
-        
         while (true) {
-            ssize_t n = recv(fd_, buf, sizeof(buf), 0);
-            if (n <= 0) {
-                close_connection();
-                return false;
+            if (binary_protocol && pending_.size() >= 5) {
+                size_t body_len = 0;
+                for (int i = 1; i < 5; ++i) body_len = body_len << 8 | (unsigned char)pending_[i];
+                if (pending_.size() >= 5 + body_len) {
+                    response.assign(pending_, 0, 5 + body_len);
+                    pending_.erase(0, 5 + body_len);
+                    return true;
+                }
             }
-            
-            response.append(buf, n);
-            
-            // Parse headers to get Content-Length
-            if (!headers_complete) {
-                header_end_pos = response.find("\r\n\r\n");
-                if (header_end_pos != std::string::npos) {
-                    headers_complete = true;
-                    
-                    // Extract Content-Length
-                    size_t cl_pos = response.find("Content-Length:");
-                    if (cl_pos != std::string::npos) {
+            size_t header_end_pos = binary_protocol ? std::string::npos : pending_.find("\r\n\r\n");
+            if (header_end_pos != std::string::npos) {
+                size_t total = 0;
+                size_t te_pos = pending_.find("Transfer-Encoding: chunked");
+                if (te_pos != std::string::npos && te_pos < header_end_pos) {
+                    total = chunked_end(header_end_pos + 4);
+                } else {
+                    size_t content_length = 0;
+                    size_t cl_pos = pending_.find("Content-Length:");
+                    if (cl_pos != std::string::npos && cl_pos < header_end_pos) {
                         size_t cl_start = cl_pos + 15;
-                        size_t cl_end = response.find("\r\n", cl_start);
-                        std::string cl_str = response.substr(cl_start, cl_end - cl_start);
-                        content_length = std::stoull(cl_str);
+                        size_t cl_end = pending_.find("\r\n", cl_start);
+                        content_length = std::stoull(pending_.substr(cl_start, cl_end - cl_start));
                     }
+                    total = header_end_pos + 4 + content_length;
+                    if (pending_.size() < total) total = 0;
                 }
-            }
-            
-            // Check if we have received the complete response
-            if (headers_complete) {
-                size_t body_start = header_end_pos + 4;
-                size_t body_received = response.size() - body_start;
-                if (body_received >= content_length) {
-                    break;
+                if (total) {
+                    response.assign(pending_, 0, total);
+                    pending_.erase(0, total);
+                    return true;
                 }
             }
+
+            ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+            syscalls_recv++;
+            if (n <= 0) {
+                close_connection();
+                return false;
+            }
+            pending_.append(buf, n);
         }
-        
-        return true;
     }
-    
-private:
-    int fd_;
+
+    // End of a chunked body starting at pos in pending_, or 0 if the last
+    // chunk has not arrived yet.
+    size_t chunked_end(size_t pos) const {
+        while (true) {
+            size_t eol = pending_.find("\r\n", pos);
+            if (eol == std::string::npos) return 0;
+            size_t size = std::stoull(pending_.substr(pos, eol - pos), nullptr, 16);
+            size_t next = eol + 2 + size + 2;
+            if (pending_.size() < next) return 0;
+            if (size == 0) return next;
+            pos = next;
+        }
+    }
+
 };
 
-bool http_request_persistent(PersistentConnection& conn, const std::string& method, 
-                             const std::string& path, const std::string& body, 
-                             long long* latency_us, bool* is_cache_hit) {
-    auto t0 = std::chrono::high_resolution_clock::now();
-    
-    std::string response;
-    bool success = conn.send_request(method, path, body, response);
-    
-    *latency_us = std::chrono::duration_cast<std::chrono::microseconds>(
-        std::chrono::high_resolution_clock::now() - t0).count();
-    
-    if (!success) return false;
-    
-    if (is_cache_hit) {
-        *is_cache_hit = response.find("X-Cache-Status: HIT") != std::string::npos;
+// Requests a worker has queued but not sent yet. With a pipeline depth
+// of 1 every request is sent on its own and waits for its response.
+struct Pipeline {
+    PersistentConnection& conn;
+    Metrics& m;
+    size_t depth;
+    std::vector<std::string> reqs;
+    std::vector<bool> is_get;
+    std::vector<int> keys;   // keys carried by each request (_mget/_mput > 1)
+    std::vector<std::string> responses;
+
+    Pipeline(PersistentConnection& conn, Metrics& m, size_t depth)
+        : conn(conn), m(m), depth(std::max<size_t>(1, depth)) {}
+    ~Pipeline() {
+        flush();
+        m.send_calls += conn.syscalls_send;
+        m.recv_calls += conn.syscalls_recv;
+    }
+
+    void issue(const std::string& method, const std::string& path, const std::string& body,
+               int nkeys = 1) {
+        reqs.push_back(binary_protocol ? PersistentConnection::build_binary(method, path, body)
+                                       : PersistentConnection::build_request(method, path, body));
+        is_get.push_back(nkeys >= 0 && (method == "GET" || path == "/_mget"));   // not scans (nkeys < 0)
+        keys.push_back(nkeys);
+        if (reqs.size() >= depth) flush();
     }
-    
-    return response.find("200 OK") != std::string::npos;
-}
+
+    // Rows in a chunked scan response ("<klen> <vlen>\n<key><value>" each).
+    static long long scan_rows(const std::string& resp) {
+        std::string body;
+        size_t pos = resp.find("\r\n\r\n") + 4;
+        while (true) {
+            size_t eol = resp.find("\r\n", pos);
+            size_t size = std::stoull(resp.substr(pos, eol - pos), nullptr, 16);
+            if (size == 0) break;
+            body.append(resp, eol + 2, size);
+            pos = eol + 2 + size + 2;
+        }
+        long long rows = 0;
+        for (size_t off = 0; off < body.size(); ++rows) {
+            size_t sp = body.find(' ', off), nl = body.find('\n', sp);
+            off = nl + 1 + std::stoull(body.substr(off, sp - off)) + std::stoull(body.substr(sp + 1, nl - sp - 1));
+        }
+        return rows;
+    }
+
+    // Every request in the batch is charged the batch's round-trip time.
+    void flush() {
+        if (reqs.empty()) return;
+        auto t0 = std::chrono::high_resolution_clock::now();
+        bool success = conn.send_batch(reqs, responses);
+        long long latency_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::high_resolution_clock::now() - t0).count();
+
+        for (size_t i = 0; i < reqs.size(); ++i) {
+            bool ok, hit;
+            if (binary_protocol) {
+                // status byte: 0 is OK, 0x80 flags an answer from the cache
+                uint8_t status = success && i < responses.size() ? responses[i][0] : 0xff;
+                ok = (status & 0x7f) == 0;
+                hit = ok && (status & 0x80);
+            } else {
+                ok = success && i < responses.size() &&
+                     responses[i].find("200 OK") != std::string::npos;
+                hit = ok && (responses[i].find("X-Cache-Status: HIT") != std::string::npos ||
+                             responses[i].find("X-Cache-Hits: " + std::to_string(keys[i]) + "\r\n") !=
+                                 std::string::npos);
+            }
+            m.add_result(latency_us, ok, hit, is_get[i]);
+            if (ok) m.keys_done += keys[i] < 0 ? scan_rows(responses[i]) : keys[i];
+        }
+        reqs.clear();
+        is_get.clear();
+        keys.clear();
+    }
+};
 
 class ZipfianGenerator {
 public:
@@ -218,12 +367,13 @@ private:
     std::uniform_real_distribution<> dist{0.0, 1.0};
 };
 
-void worker_put(int thread_id, int keys_per_thread, int duration_sec, int total_keys, Metrics& m) {
+void worker_put(int thread_id, int keys_per_thread, int duration_sec, int total_keys, int pipeline, Metrics& m) {
     PersistentConnection conn;
     if (!conn.connect()) {
         std::cerr << "Thread " << thread_id << ": Failed to connect\n";
         return;
     }
+    Pipeline p(conn, m, pipeline);
     
     auto start = std::chrono::steady_clock::now();
     int idx = 0;
@@ -236,19 +386,18 @@ void worker_put(int thread_id, int keys_per_thread, int duration_sec, int total_
         std::string key = "key_" + std::to_string((thread_id * keys_per_thread + idx) % total_keys);
         std::string val = "VALUE_START_" + std::string(4096, 'A') + "_END";
 
-        long long lat;
-        bool ok = http_request_persistent(conn, "PUT", "/kv/" + key, val, &lat, nullptr);
-        m.add_result(lat, ok, false, false);
+        p.issue("PUT", "/kv/" + key, val);
         idx++;
     }
 }
 
-void worker_get_all(int thread_id, int keys_per_thread, int duration_sec, int total_keys, Metrics& m) {
+void worker_get_all(int thread_id, int keys_per_thread, int duration_sec, int total_keys, int pipeline, Metrics& m) {
     PersistentConnection conn;
     if (!conn.connect()) {
         std::cerr << "Thread " << thread_id << ": Failed to connect\n";
         return;
     }
+    Pipeline p(conn, m, pipeline);
     
     auto start = std::chrono::steady_clock::now();
     int idx = 0;
@@ -260,20 +409,18 @@ void worker_get_all(int thread_id, int keys_per_thread, int duration_sec, int to
         
         std::string key = "key_" + std::to_string((thread_id * keys_per_thread + (idx % keys_per_thread)) % total_keys);
         
-        long long lat;
-        bool hit = false;
-        bool ok = http_request_persistent(conn, "GET", "/kv/" + key, "", &lat, &hit);
-        m.add_result(lat, ok, hit, true);
+        p.issue("GET", "/kv/" + key, "");
         idx++;
     }
 }
 
-void worker_get_popular(int thread_id, int keys_per_thread, int duration_sec, int total_keys, Metrics& m) {
+void worker_get_popular(int thread_id, int keys_per_thread, int duration_sec, int total_keys, int pipeline, Metrics& m) {
     PersistentConnection conn;
     if (!conn.connect()) {
         std::cerr << "Thread " << thread_id << ": Failed to connect\n";
         return;
     }
+    Pipeline p(conn, m, pipeline);
     
     ZipfianGenerator zipf(total_keys, 1.5);
     auto start = std::chrono::steady_clock::now();
@@ -286,20 +433,18 @@ void worker_get_popular(int thread_id, int keys_per_thread, int duration_sec, in
         
         std::string key = "key_" + std::to_string(zipf.next());
         
-        long long lat;
-        bool hit = false;
-        bool ok = http_request_persistent(conn, "GET", "/kv/" + key, "", &lat, &hit);
-        m.add_result(lat, ok, hit, true);
+        p.issue("GET", "/kv/" + key, "");
         idx++;
     }
 }
 
-void worker_mixed(int thread_id, int keys_per_thread, int duration_sec, int total_keys, Metrics& m) {
+void worker_mixed(int thread_id, int keys_per_thread, int duration_sec, int total_keys, int pipeline, Metrics& m) {
     PersistentConnection conn;
     if (!conn.connect()) {
         std::cerr << "Thread " << thread_id << ": Failed to connect\n";
         return;
     }
+    Pipeline p(conn, m, pipeline);
     
     std::mt19937 gen(std::random_device{}());
     std::uniform_real_distribution<> dist(0.0, 1.0);
@@ -312,20 +457,117 @@ void worker_mixed(int thread_id, int keys_per_thread, int duration_sec, int tota
         if (duration_sec == 0 && idx >= keys_per_thread) break;
         
         std::string key = "key_" + std::to_string((thread_id * keys_per_thread + (idx % keys_per_thread)) % total_keys);
-        long long lat;
         
         if (dist(gen) < 0.1) {
-            bool ok = http_request_persistent(conn, "PUT", "/kv/" + key, "value_" + std::to_string(idx), &lat, nullptr);
-            m.add_result(lat, ok, false, false);
+            p.issue("PUT", "/kv/" + key, "value_" + std::to_string(idx));
         } else {
-            bool hit = false;
-            bool ok = http_request_persistent(conn, "GET", "/kv/" + key, "", &lat, &hit);
-            m.add_result(lat, ok, hit, true);
+            p.issue("GET", "/kv/" + key, "");
+        }
+        idx++;
+    }
+}
+
+// _mput of `batch` consecutive keys per request, framed as
+// "<key-len> <value-len>\n<key><value>" per entry.
+void worker_mput(int thread_id, int keys_per_thread, int duration_sec, int total_keys, int pipeline,
+                 int batch, Metrics& m) {
+    PersistentConnection conn;
+    if (!conn.connect()) {
+        std::cerr << "Thread " << thread_id << ": Failed to connect\n";
+        return;
+    }
+    Pipeline p(conn, m, pipeline);
+
+    std::string val = "VALUE_START_" + std::string(4096, 'A') + "_END";
+    auto start = std::chrono::steady_clock::now();
+    int idx = 0;
+
+    while (!stop_flag) {
+        if (duration_sec > 0 && std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now() - start).count() >= duration_sec) break;
+        if (duration_sec == 0 && idx >= keys_per_thread) break;
+
+        std::string body;
+        int n = 0;
+        for (; n < batch && (duration_sec > 0 || idx < keys_per_thread); ++n, ++idx) {
+            std::string key = "key_" + std::to_string((thread_id * keys_per_thread + idx) % total_keys);
+            body += std::to_string(key.size()) + " " + std::to_string(val.size()) + "\n" + key + val;
+        }
+        p.issue("POST", "/_mput", body, n);
+    }
+}
+
+// _mget of `batch` consecutive keys per request, one key per line.
+void worker_mget(int thread_id, int keys_per_thread, int duration_sec, int total_keys, int pipeline,
+                 int batch, Metrics& m) {
+    PersistentConnection conn;
+    if (!conn.connect()) {
+        std::cerr << "Thread " << thread_id << ": Failed to connect\n";
+        return;
+    }
+    Pipeline p(conn, m, pipeline);
+
+    auto start = std::chrono::steady_clock::now();
+    int idx = 0;
+
+    while (!stop_flag) {
+        if (duration_sec > 0 && std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now() - start).count() >= duration_sec) break;
+        if (duration_sec == 0 && idx >= keys_per_thread) break;
+
+        std::string body;
+        int n = 0;
+        for (; n < batch && (duration_sec > 0 || idx < keys_per_thread); ++n, ++idx) {
+            body += "key_" + std::to_string((thread_id * keys_per_thread + (idx % keys_per_thread)) % total_keys);
+            body += '\n';
         }
+        p.issue("POST", "/_mget", body, n);
+    }
+}
+
+// Ordered scans of up to `batch` rows from a random key_ position.
+void worker_scan(int thread_id, int keys_per_thread, int duration_sec, int total_keys, int pipeline,
+                 int batch, Metrics& m) {
+    PersistentConnection conn;
+    if (!conn.connect()) {
+        std::cerr << "Thread " << thread_id << ": Failed to connect\n";
+        return;
+    }
+    Pipeline p(conn, m, pipeline);
+
+    std::mt19937 gen(std::random_device{}() + thread_id);
+    std::uniform_int_distribution<int> pick(0, std::max(0, total_keys - 1));
+    auto start = std::chrono::steady_clock::now();
+    int idx = 0;
+
+    while (!stop_flag) {
+        if (duration_sec > 0 && std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now() - start).count() >= duration_sec) break;
+        if (duration_sec == 0 && idx >= keys_per_thread) break;
+
+        std::string from = "key_" + std::to_string(pick(gen));
+        p.issue("GET", "/kv?prefix=key_&start=" + from + "&limit=" + std::to_string(batch), "", -1);
         idx++;
     }
 }
 
+// Polls the server's rss_bytes from /stats until stop_flag, keeping the peak.
+void sample_rss(std::atomic<bool>& done, std::atomic<long long>& peak) {
+    PersistentConnection conn;
+    std::vector<std::string> resp;
+    const std::string req = PersistentConnection::build_request("GET", "/stats", "");
+    while (!done) {
+        if (conn.send_batch({req}, resp)) {
+            size_t pos = resp[0].find("rss_bytes ");
+            if (pos != std::string::npos) {
+                long long rss = std::stoll(resp[0].substr(pos + 10));
+                if (rss > peak) peak = rss;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+}
+
 void run_benchmark(const std::string& workload,
                    int num_keys,
                    int num_threads,
@@ -333,7 +575,13 @@ void run_benchmark(const std::string& workload,
                    int server_threads,
                    int cache_capacity,
                    int db_pool_size,
+                   int pipeline,
+                   int batch,
                    std::ofstream& csv) {
+    if (binary_protocol && (workload == "mput_all" || workload == "scan")) {
+        std::cerr << "The binary protocol has no " << workload << " equivalent\n";
+        return;
+    }
     Metrics m;
     stop_flag = false;
     auto start = std::chrono::high_resolution_clock::now();
@@ -343,16 +591,29 @@ void run_benchmark(const std::string& workload,
     
     for (int t = 0; t < num_threads; ++t) {
         if (workload == "put_all") 
-            threads.emplace_back(worker_put, t, keys_per_thread, duration_sec, num_keys, std::ref(m));
+            threads.emplace_back(worker_put, t, keys_per_thread, duration_sec, num_keys, pipeline, std::ref(m));
         else if (workload == "get_all") 
-            threads.emplace_back(worker_get_all, t, keys_per_thread, duration_sec, num_keys, std::ref(m));
+            threads.emplace_back(worker_get_all, t, keys_per_thread, duration_sec, num_keys, pipeline, std::ref(m));
         else if (workload == "get_popular") 
-            threads.emplace_back(worker_get_popular, t, keys_per_thread, duration_sec, num_keys, std::ref(m));
+            threads.emplace_back(worker_get_popular, t, keys_per_thread, duration_sec, num_keys, pipeline, std::ref(m));
         else if (workload == "mixed") 
-            threads.emplace_back(worker_mixed, t, keys_per_thread, duration_sec, num_keys, std::ref(m));
+            threads.emplace_back(worker_mixed, t, keys_per_thread, duration_sec, num_keys, pipeline, std::ref(m));
+        else if (workload == "mput_all")
+            threads.emplace_back(worker_mput, t, keys_per_thread, duration_sec, num_keys, pipeline, batch, std::ref(m));
+        else if (workload == "mget_all")
+            threads.emplace_back(worker_mget, t, keys_per_thread, duration_sec, num_keys, pipeline, batch, std::ref(m));
+        else if (workload == "scan")
+            threads.emplace_back(worker_scan, t, keys_per_thread, duration_sec, num_keys, pipeline, batch, std::ref(m));
     }
+
+    std::atomic<bool> sampling_done{false};
+    std::atomic<long long> peak_rss{0};
+    std::thread sampler;
+    if (workload == "scan") sampler = std::thread(sample_rss, std::ref(sampling_done), std::ref(peak_rss));
     
     for (auto& th : threads) th.join();
+    sampling_done = true;
+    if (sampler.joinable()) sampler.join();
     
     double elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
         std::chrono::high_resolution_clock::now() - start).count() / 1000000.0;
@@ -371,6 +632,19 @@ void run_benchmark(const std::string& workload,
     std::cout << "Throughput: " << throughput << " ops/sec\n";
     std::cout << "Avg latency: " << avg_lat << " ms\n";
     std::cout << "Hit rate: " << hit_rate << "% (" << m.cache_hits.load() << "/" << gets << ")\n";
+    double syscalls_per_req = (total > 0) ? (double)(m.send_calls + m.recv_calls) / total : 0.0;
+    if (workload == "mput_all" || workload == "mget_all") {
+        double keys_per_sec = (elapsed > 0) ? (double)m.keys_done.load() / elapsed : 0.0;
+        std::cout << "Batch: " << batch << " keys per request, " << keys_per_sec << " keys/sec\n";
+    }
+    if (workload == "scan") {
+        double rows_per_sec = (elapsed > 0) ? (double)m.keys_done.load() / elapsed : 0.0;
+        std::cout << "Scan: " << m.keys_done.load() << " rows, " << rows_per_sec << " rows/sec, "
+                  << "server peak RSS " << peak_rss.load() / (1024 * 1024) << " MB\n";
+    }
+    std::cout << "Protocol: " << (binary_protocol ? "binary" : "http") << " on port " << server_port << "\n";
+    std::cout << "Pipeline depth: " << pipeline << ", syscalls: " << m.send_calls.load() << " send + "
+              << m.recv_calls.load() << " recv (" << syscalls_per_req << " per request)\n";
 
     std::time_t now = std::time(nullptr);
     csv << now << ","
@@ -386,7 +660,10 @@ void run_benchmark(const std::string& workload,
         << hit_rate << ","
         << server_threads << ","
         << cache_capacity << ","
-        << db_pool_size
+        << db_pool_size << ","
+        << pipeline << ","
+        << batch << ","
+        << (binary_protocol ? "binary" : "http")
         << "\n";
 }
 
@@ -398,29 +675,63 @@ int main(int argc, char* argv[]) {
     int server_threads  = 0;
     int cache_capacity  = 0;
     int db_pool_size    = 0;
+    int pipeline        = 1;
+    int batch           = 16;
     
     for (int i = 1; i < argc; i += 2) {
         if (i + 1 >= argc) break;
         std::string arg = argv[i];
-        if (arg == "--keys") num_keys = std::stoi(argv[i + 1]);
-        else if (arg == "--threads") num_threads = std::stoi(argv[i + 1]);
-        else if (arg == "--duration") duration_sec = std::stoi(argv[i + 1]);
-        else if (arg == "--workload") workload = argv[i + 1];
-        else if (arg == "--server-threads") server_threads = std::stoi(argv[i + 1]);
-        else if (arg == "--cache-size")     cache_capacity = std::stoi(argv[i + 1]);
-        else if (arg == "--db-pool")        db_pool_size   = std::stoi(argv[i + 1]);
+        bool ok = true;
+        if (arg == "--keys")                ok = parse_int(argv[i + 1], 1, num_keys);
+        else if (arg == "--threads")        ok = parse_int(argv[i + 1], 1, num_threads);
+        else if (arg == "--duration")       ok = parse_int(argv[i + 1], 0, duration_sec);
+        else if (arg == "--workload")       workload = argv[i + 1];
+        else if (arg == "--server-threads") ok = parse_int(argv[i + 1], 0, server_threads);
+        else if (arg == "--cache-size")     ok = parse_int(argv[i + 1], 0, cache_capacity);
+        else if (arg == "--db-pool")        ok = parse_int(argv[i + 1], 0, db_pool_size);
+        else if (arg == "--pipeline")       ok = parse_int(argv[i + 1], 1, pipeline);
+        else if (arg == "--batch")          ok = parse_int(argv[i + 1], 1, batch);
+        else if (arg == "--port")           ok = parse_int(argv[i + 1], 1, server_port) && server_port <= 65535;
+        else if (arg == "--protocol") {
+            std::string proto = argv[i + 1];
+            ok = proto == "http" || proto == "binary";
+            binary_protocol = proto == "binary";
+        }
+        if (!ok) {
+            std::cerr << "Invalid value for " << arg << ": " << argv[i + 1] << std::endl;
+            return 1;
+        }
     }
     
+    const std::string header =
+        "timestamp,threads,workload,num_keys,duration,requests,get_requests,"
+        "throughput,avg_latency_ms,hit_rate,"
+        "server_threads,cache_capacity,db_pool_size,pipeline,batch,protocol";
+
+    // Rows are only appended under the header they match; a results.csv
+    // written by a build with other columns is moved aside first.
+    std::string existing;
+    {
+        std::ifstream in("results.csv");
+        std::getline(in, existing);
+    }
+    if (!existing.empty() && existing != header) {
+        std::string aside = "results." + std::to_string(std::time(nullptr)) + ".csv";
+        if (std::rename("results.csv", aside.c_str()) != 0) {
+            std::cerr << "results.csv has other columns and could not be moved aside\n";
+            return 1;
+        }
+        std::cout << "results.csv has other columns, moved to " << aside << "\n";
+    }
+
     std::ofstream csv("results.csv", std::ios::app);
     
     if (csv.tellp() == 0) {
-        csv << "timestamp,threads,workload,num_keys,duration,requests,get_requests,"
-               "throughput,avg_latency_ms,hit_rate,"
-               "server_threads,cache_capacity,db_pool_size\n";
+        csv << header << "\n";
     }
     
     run_benchmark(workload, num_keys, num_threads, duration_sec,
-                  server_threads, cache_capacity, db_pool_size, csv);
+                  server_threads, cache_capacity, db_pool_size, pipeline, batch, csv);
     
     csv.close();
     return 0;
@@ -0,0 +1,75 @@
+#pragma once
+#include <deque>
+#include <functional>
+#include <chrono>
+#include <string>
+#include "database.h"
+
+class Reactor;
+
+// A Postgres connection driven by a reactor instead of a blocked thread.
+// Once connected the socket is nonblocking and in pipeline mode: submit()
+// sends the prepared statement with its own sync and returns at once, the
+// reactor polls the socket, and when the result has been read the callback
+// runs on the loop thread. Any number of statements can be waiting on one
+// connection, so slow queries hold a slot in a queue, not a worker.
+//
+// A lost connection is re-established from the loop as well: PQresetPoll
+// and the statement preparations are driven by socket readiness, and
+// statements submitted meanwhile wait for the outcome.
+class AsyncDatabase {
+public:
+    // delivered is false when the connection failed before the result came
+    using Callback = std::function<void(bool delivered)>;
+
+    explicit AsyncDatabase(const std::string& conninfo);
+    ~AsyncDatabase();
+
+    // blocking; prepares the statements like Database
+    bool connect();
+    // registers the socket with the loop; everything below runs on that
+    // loop's thread
+    void attach(Reactor& loop);
+
+    void submit(DBOp* op, Callback done);
+    // runs every pending callback with delivered false; for shutdown, once
+    // the loop has stopped and can no longer deliver results
+    void abandon();
+    size_t in_flight() const { return inflight_.size() + waiting_.size(); }
+    DBStats stats() const { return db_.stats(); }
+
+private:
+    struct InFlight {
+        DBOp* op;
+        Callback done;
+        std::chrono::steady_clock::time_point sent;
+    };
+
+    enum class State {
+        Ready,
+        Broken,       // waiting for the next submit() to start a reconnect
+        Connecting,   // PQresetPoll in progress
+        Preparing,    // connected; statement preparations in flight
+    };
+
+    Database db_;
+    Reactor* loop_ = nullptr;
+    int fd_ = -1;
+    uint32_t events_ = 0;      // current interest in fd_
+    bool want_write_ = false;
+    State state_ = State::Ready;
+    std::chrono::steady_clock::time_point last_reconnect_{};
+    std::deque<InFlight> inflight_;
+    std::deque<InFlight> waiting_;   // submitted while reconnecting
+
+    bool enter_async_mode();
+    bool send(DBOp* op, Callback& done);
+    bool flush();
+    void rearm(uint32_t events);
+    void on_ready(uint32_t events);
+    void read_results();
+    void fail(const char* what);
+    void start_reconnect();
+    void poll_reconnect();
+    void read_prepares();
+};
@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Length-prefixed protocol spoken on --binary-port, for clients whose keys
+// and values are small enough that HTTP's text framing outweighs them.
+// All integers are big-endian.
+//
+//   request:  op:u8 key_len:u16 body_len:u32 key body
+//   response: status:u8 body_len:u32 body
+//
+// SET carries the value as its body; MGET has no key and a body of
+// key_len:u16 key entries. A GET or SET answer's body is the value; an
+// MGET answer has value_len:u32 value per key, in order, with kNil for a
+// key that does not exist. Requests may be pipelined; answers come back in
+// the order the requests were sent.
+//
+// Keys, in a frame or an MGET body, are at most kMaxKeyBytes and may not
+// contain a NUL byte: the store keeps them in a VARCHAR(255) column, passed
+// as text, which would cut them at the NUL. A frame with such a key is
+// malformed.
+namespace binproto {
+
+enum class Op : uint8_t { Get = 1, Set = 2, Del = 3, MGet = 4 };
+
+enum Status : uint8_t {
+    kOk = 0,
+    kNotFound = 1,
+    kBadRequest = 2,
+    kBusy = 3,        // overloaded: retry later
+    kError = 4,       // database unavailable
+};
+// or'd into the status when the answer came from the cache (for MGET:
+// every key did)
+constexpr uint8_t kCached = 0x80;
+
+constexpr size_t kRequestHeader = 7;
+constexpr size_t kResponseHeader = 5;
+constexpr uint32_t kNil = 0xffffffff;
+constexpr size_t kMaxKeyBytes = 255;
+constexpr size_t kMaxBodyBytes = 64 * 1024 * 1024;
+
+struct Frame {
+    Op op;
+    std::string_view key;
+    std::string_view body;
+    size_t size;            // bytes of data the frame takes up
+};
+
+enum class ParseStatus { Incomplete, Done, Error };
+
+// Decodes the frame at the start of data. Views point into data.
+ParseStatus parse(const char* data, size_t len, Frame& frame);
+
+// The HTTP method the server handles an op as: GET, PUT, DELETE or MGET.
+std::string_view method(Op op);
+
+// MGET body into its keys; false if malformed or empty.
+bool parse_keys(std::string_view body, std::vector<std::string>& keys);
+
+std::string response_head(uint8_t status, size_t body_len);
+void append_u32(std::string& out, uint32_t v);
+
+} // namespace binproto
@@ -0,0 +1,207 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <set>
+#include <string_view>
+#include <optional>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "storage.h"
+
+// Embedded log-structured store in the style of Bitcask. Every write is
+// appended to the active segment file in dir; an in-memory hash index maps
+// each live key to where its latest record sits, so a read is one lookup
+// and one pread. Records carry a CRC-32C that is checked on recovery and
+// on every read. Segments roll over at segment_bytes; a background thread
+// rewrites the live records of closed segments that are mostly dead into
+// the active one and deletes them.
+//
+// Record: crc:u32 key_len:u32 value_len:u32 key value (host byte order),
+// the CRC covering everything after itself. A delete is a tombstone
+// record with value_len 0xffffffff and no value.
+//
+// On startup the segments are replayed in order to rebuild the index; a
+// torn or corrupt record at the end of the newest segment (a crash
+// mid-write) is cut off.
+class Bitcask {
+public:
+    enum class Sync {
+        Always,     // fdatasync before a write is acknowledged
+        Interval,   // fdatasync the active segment every sync_interval
+        Never,      // leave it to the page cache
+    };
+
+    struct Options {
+        std::string dir = "data";
+        Sync sync = Sync::Interval;
+        std::chrono::milliseconds sync_interval{1000};
+        size_t segment_bytes = 64 << 20;
+        // a closed segment is compacted once this share of it is dead
+        double compact_ratio = 0.5;
+        std::chrono::milliseconds compact_interval{10000};
+    };
+
+    struct Stats {
+        size_t keys = 0;
+        size_t segments = 0;
+        uint64_t disk_bytes = 0;
+        uint64_t dead_bytes = 0;        // overwritten, deleted or tombstones
+        uint64_t syncs = 0;
+        uint64_t compactions = 0;       // segments rewritten and deleted
+        uint64_t reclaimed_bytes = 0;
+        uint64_t corrupt_records = 0;   // failed their CRC on recovery or read
+    };
+
+    explicit Bitcask(const Options& options);
+    ~Bitcask();
+
+    bool is_open() const { return open_; }
+
+    bool put(const std::string& key, const std::string& value);
+    // false on a read error or bad CRC; an absent key leaves value empty
+    bool get(const std::string& key, std::optional<std::string>& value);
+    bool remove(const std::string& key);
+    // all records in one write (and one fdatasync with Sync::Always)
+    bool write_batch(const std::vector<Storage::KeyValue>& upserts,
+                     const std::vector<const std::string*>& deletes);
+
+    // Live keys that start with prefix, from start on, sorted, at most
+    // limit (0 = all). Served from the ordered key set, so a call costs
+    // one lookup plus the keys it returns. Values are read separately, so
+    // a key deleted in between simply comes back empty.
+    std::vector<std::string> keys(const std::string& prefix, const std::string& start, size_t limit) const;
+    // Live keys that start with prefix in partition part of parts of the
+    // index's hash buckets, at most limit (0 = all). Unsorted, so the walk
+    // stops as soon as limit keys are found. The parts are disjoint as
+    // long as no key is added between calls (which could rehash).
+    std::vector<std::string> partition_keys(const std::string& prefix, uint32_t part, uint32_t parts,
+                                            size_t limit) const;
+
+    // The cache snapshot token (see Storage::load_epoch), in a file of
+    // its own in dir. Storing one syncs the log first: the token vouches
+    // for what is on disk.
+    bool load_epoch(std::string& token) const;
+    bool store_epoch(const std::string& token);
+
+    // fdatasync the active segment
+    void sync();
+    // stops compaction and syncing, then syncs one last time
+    void close();
+    Stats stats() const;
+
+private:
+    struct Segment {
+        uint32_t id;
+        int fd;
+        std::string path;
+        std::atomic<uint64_t> size{0};
+        std::atomic<uint64_t> dead{0};
+
+        Segment(uint32_t id, int fd, std::string path) : id(id), fd(fd), path(std::move(path)) {}
+        ~Segment();
+    };
+
+    struct Location {
+        uint32_t segment;
+        uint32_t size;        // whole record
+        uint64_t offset;      // of the record
+        uint32_t value_len;
+
+        bool operator==(const Location& o) const { return segment == o.segment && offset == o.offset; }
+    };
+
+    // A record to append. With check set it is a compaction copy and is
+    // only written if the key still has expect (or, for a tombstone, is
+    // still absent) once the write lock is held.
+    struct Pending {
+        const std::string* key;
+        const std::string* value;   // nullptr: tombstone
+        bool check = false;
+        Location expect{};
+    };
+
+    Options opts_;
+    bool open_ = false;
+
+    // appends, segment roll-over and every index update
+    std::mutex write_mtx_;
+    std::shared_ptr<Segment> active_;
+    uint32_t next_id_ = 1;
+    std::atomic<bool> dirty_{false};   // written since the last sync
+    // index_ and segments_; held shared by readers
+    mutable std::shared_mutex index_mtx_;
+    std::unordered_map<std::string, Location> index_;
+    // the keys of index_ in byte order, for scans; views of the map's own
+    // keys, which stay put when it rehashes
+    std::set<std::string_view> ordered_;
+    std::unordered_map<uint32_t, std::shared_ptr<Segment>> segments_;
+
+    std::atomic<uint64_t> syncs_{0};
+    std::atomic<uint64_t> compactions_{0};
+    std::atomic<uint64_t> reclaimed_{0};
+    std::atomic<uint64_t> corrupt_{0};
+
+    std::mutex bg_mtx_;
+    std::condition_variable bg_cv_;
+    bool stopping_ = false;
+    std::thread syncer_;
+    std::thread compactor_;
+
+    bool recover();
+    bool replay(Segment& seg, bool newest);
+    std::shared_ptr<Segment> open_segment(uint32_t id);
+    bool roll_locked();
+    bool append(const std::vector<Pending>& records);
+    void apply_locked(const std::string& key, const Location& loc, bool tombstone);
+
+    void syncer_loop();
+    void compactor_loop();
+    void compact(const std::shared_ptr<Segment>& seg);
+};
+
+// A Storage session on a shared Bitcask: what DBConnectionPool hands out
+// when the server runs on the embedded engine. The engine does its own
+// locking; the session only adds per-session latency counters and scan
+// state.
+class BitcaskStore : public Storage {
+public:
+    explicit BitcaskStore(Bitcask& db) : db_(db) {}
+
+    bool connect() override { return db_.is_open(); }
+    bool put(const std::string& key, const std::string& value) override;
+    bool get(const std::string& key, std::optional<std::string>& value) override;
+    bool remove(const std::string& key) override;
+    bool get_many(const std::vector<const std::string*>& keys,
+                  std::vector<std::optional<std::string>>& values) override;
+    bool write_batch(const std::vector<KeyValue>& upserts,
+                     const std::vector<const std::string*>& deletes) override;
+
+    // Each fetch takes the next chunk of keys after the last one returned
+    // from the engine's ordered key set, so a scan holds one chunk
+    // however many keys match.
+    bool scan_open(const std::string& prefix, const std::string& start, size_t limit) override;
+    bool scan_fetch(size_t n, std::vector<Row>& rows) override;
+    void scan_close() override;
+
+    // partitioned on the index's hash buckets
+    bool dump(const DumpFilter& filter, const RowSink& sink) override;
+
+    bool load_epoch(std::string& token) override { return db_.load_epoch(token); }
+    bool store_epoch(const std::string& token) override { return db_.store_epoch(token); }
+
+    DBStats stats() const override;
+
+private:
+    Bitcask& db_;
+    LatencyTimer put_timer_, get_timer_, remove_timer_, scan_timer_;
+    std::string scan_prefix_;
+    std::string scan_next_;    // the scan resumes at the first key >= this
+    size_t scan_left_ = 0;     // rows still allowed by the limit
+};
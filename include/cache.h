@@ -1,22 +1,156 @@
 #pragma once
 #include <string>
-#include <unordered_map>
-#include <list>
 #include <mutex>
-#include <optional>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include "frequency_sketch.h"
 
+// Values are immutable and shared: a hit hands out a reference to the
+// cached buffer and the response path sends it from there.
+using CacheValue = std::shared_ptr<const std::string>;
+
+struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t admitted = 0;    // new keys let in by the admission filter
+    uint64_t rejected = 0;    // new keys turned away (admission filter or no room)
+    uint64_t evictions = 0;
+    size_t entries = 0;
+    size_t memory_used = 0;   // bytes, for engines that budget by size
+    size_t memory_limit = 0;
+
+    CacheStats& operator+=(const CacheStats& o) {
+        hits += o.hits; misses += o.misses;
+        admitted += o.admitted; rejected += o.rejected;
+        evictions += o.evictions; entries += o.entries;
+        memory_used += o.memory_used; memory_limit += o.memory_limit;
+        return *this;
+    }
+};
+
+// Counter split over cache lines so threads on different cores do not
+// contend on one atomic; load() sums the stripes.
+class StripedCounter {
+public:
+    void add(uint64_t n = 1) {
+        thread_local size_t stripe = std::hash<std::thread::id>{}(std::this_thread::get_id()) % kStripes;
+        stripes_[stripe].v.fetch_add(n, std::memory_order_relaxed);
+    }
+    uint64_t load() const {
+        uint64_t total = 0;
+        for (const auto& s : stripes_) total += s.v.load(std::memory_order_relaxed);
+        return total;
+    }
+private:
+    static constexpr size_t kStripes = 16;
+    struct alignas(64) Stripe { std::atomic<uint64_t> v{0}; };
+    Stripe stripes_[kStripes];
+};
+
+// Interface for the cache engines the server can be started with.
+class Cache {
+public:
+    virtual ~Cache() = default;
+
+    // nullptr on a miss
+    virtual CacheValue get(const std::string& key) = 0;
+    virtual void put(const std::string& key, CacheValue value) = 0;
+    virtual void remove(const std::string& key) = 0;
+    virtual size_t size() const = 0;
+    virtual CacheStats stats() const = 0;
+    // extra engine-specific "name value" lines for /stats
+    virtual std::string engine_report() const { return {}; }
+
+    // Every entry, shard by shard and coldest first within a shard as far
+    // as the engine tracks recency, for cache snapshots: putting them back
+    // in this order leaves the hottest keys the last to be evicted.
+    using Entry = std::pair<std::string, CacheValue>;
+    virtual void entries(std::vector<Entry>& out) const = 0;
+};
+
+// Entries live in a Swiss-style open-addressing table: one metadata byte
+// per slot (empty, deleted or 7 hash bits) probed 16 at a time, and each
+// slot holds the key once (short keys stay inline via SSO) plus prev/next
+// slot indices for recency. Lookups touch the metadata group and the slot,
+// with no bucket or list-node pointers to chase.
+//
+// With admission enabled this is W-TinyLFU: new keys land in a small LRU
+// window (1% of capacity), and a key leaving the window only enters the
+// main LRU if the frequency sketch rates it above the main LRU's victim.
+// A one-off scan therefore churns the window instead of the hot set.
 class LRUCache {
 public:
-    explicit LRUCache(size_t capacity);
-    
-    std::optional<std::string> get(const std::string& key);
-    void put(const std::string& key, const std::string& value);
+    explicit LRUCache(size_t capacity, bool tinylfu = false);
+
+    CacheValue get(const std::string& key);
+    void put(const std::string& key, CacheValue value);
     void remove(const std::string& key);
     size_t size() const;
-    
+    CacheStats stats() const;
+    // main LRU then window, least recent first
+    void entries(std::vector<Cache::Entry>& out) const;
+
 private:
+    static constexpr uint32_t kNil = UINT32_MAX;
+
+    struct Slot {
+        std::string key;
+        CacheValue value;
+        uint32_t prev = kNil;
+        uint32_t next = kNil;
+        bool in_window = false;
+    };
+
+    struct RecencyList {
+        uint32_t head = kNil;
+        uint32_t tail = kNil;
+        size_t size = 0;
+    };
+
     size_t max_capacity_;
-    std::list<std::pair<std::string, std::string>> items_;
-    std::unordered_map<std::string, std::list<std::pair<std::string, std::string>>::iterator> index_;
+    size_t window_capacity_ = 0;
+    std::vector<int8_t> ctrl_;
+    std::vector<Slot> slots_;
+    size_t count_ = 0;
+    size_t growth_left_ = 0;
+    RecencyList items_;    // main LRU (the whole cache when admission is off)
+    RecencyList window_;   // admission window
+    std::unique_ptr<FrequencySketch> sketch_;
+    CacheStats stats_;
     mutable std::mutex mutex_;
+
+    void put_admitted(const std::string& key, CacheValue value, uint64_t hash);
+
+    // table and list helpers, called with mutex_ held
+    size_t find(const std::string& key, uint64_t hash) const;
+    uint32_t insert(std::string key, CacheValue value, uint64_t hash);
+    void erase(uint32_t i);
+    void rehash(size_t new_slots);
+    RecencyList& list_of(uint32_t i) { return slots_[i].in_window ? window_ : items_; }
+    void link_front(RecencyList& l, uint32_t i);
+    void unlink(RecencyList& l, uint32_t i);
+    void touch(uint32_t i);
+};
+
+// Splits the capacity over independent LRUCache segments picked by key hash,
+// so lookups on different keys take different locks.
+class ShardedLRUCache : public Cache {
+public:
+    ShardedLRUCache(size_t capacity, size_t num_shards, bool tinylfu = false);
+
+    CacheValue get(const std::string& key) override;
+    void put(const std::string& key, CacheValue value) override;
+    void remove(const std::string& key) override;
+    size_t size() const override;
+    CacheStats stats() const override;
+    void entries(std::vector<Entry>& out) const override;
+
+private:
+    std::vector<std::unique_ptr<LRUCache>> shards_;
+
+    LRUCache& shard_for(const std::string& key);
 };
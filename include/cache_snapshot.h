@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include "cache.h"
+
+// Warm-restart file of a cache's contents: written on shutdown (and, if
+// asked, periodically), mapped and loaded back at startup so the hot set
+// survives a restart instead of refilling one miss at a time.
+//
+//   header: magic:8 "KVSNAP01" epoch_len:u32 count:u64 epoch
+//   entry:  key_len:u32 value_len:u32 key value
+//
+// Integers are in host byte order; a snapshot is only read back by the
+// machine that wrote it. Entries are in Cache::entries() order, coldest
+// first, so putting them back one by one restores the recency order.
+//
+// The epoch is a token the writer also stores with the data (see
+// Storage::store_epoch); a snapshot whose epoch the store no longer
+// carries describes some other state of the data and is not loaded.
+namespace cache_snapshot {
+
+enum class LoadStatus {
+    Loaded,
+    Missing,   // no file
+    Stale,     // epoch does not match the store's
+    Corrupt,   // bad magic or truncated; entries before the damage are kept
+};
+
+struct LoadResult {
+    LoadStatus status = LoadStatus::Missing;
+    size_t entries = 0;
+    size_t bytes = 0;
+};
+
+// A fresh random token to write a snapshot under.
+std::string new_epoch();
+
+// Writes the file at path and fdatasyncs it. The caller renames it into
+// place, so a reader never finds half a snapshot.
+bool write(const std::string& path, const std::string& epoch, const std::vector<Cache::Entry>& entries);
+
+// Unlinks the file at path and syncs its directory, so the removal
+// survives a crash.
+void remove(const std::string& path);
+
+// Maps the file at path and puts every entry into cache, provided it was
+// written under epoch.
+LoadResult load(const std::string& path, const std::string& epoch, Cache& cache);
+
+} // namespace cache_snapshot
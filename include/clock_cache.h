@@ -0,0 +1,61 @@
+#pragma once
+#include "cache.h"
+#include <atomic>
+#include <cstdint>
+
+// Read-optimized cache engine. Entries live in open-addressed slot tables
+// that readers probe without taking any lock; a hit only sets the entry's
+// reference bit (and only if it was clear), so hot keys do not bounce a
+// shared list between cores. Writers serialize per shard and evict with a
+// CLOCK hand. Unlinked entries are freed through EpochManager.
+class ClockCache : public Cache {
+public:
+    ClockCache(size_t capacity, size_t num_shards);
+    ~ClockCache() override;
+
+    CacheValue get(const std::string& key) override;
+    void put(const std::string& key, CacheValue value) override;
+    void remove(const std::string& key) override;
+    size_t size() const override;
+    CacheStats stats() const override;
+    // unreferenced entries of a shard before referenced ones
+    void entries(std::vector<Entry>& out) const override;
+
+private:
+    struct Node {
+        uint64_t hash;
+        std::string key;
+        CacheValue value;
+        std::atomic<bool> referenced{false};
+    };
+
+    struct Table {
+        size_t mask;
+        std::unique_ptr<std::atomic<Node*>[]> slots;
+        explicit Table(size_t n);
+    };
+
+    struct alignas(64) Shard {
+        std::atomic<Table*> table{nullptr};
+        std::mutex write_mutex;
+        size_t capacity = 0;
+        std::atomic<size_t> count{0};
+        std::atomic<uint64_t> evictions{0};
+        size_t tombstones = 0;
+        size_t hand = 0;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    StripedCounter hits_;
+    StripedCounter misses_;
+
+    static Node* tombstone();
+    static uint64_t hash_key(const std::string& key);
+
+    Shard& shard_for(uint64_t hash);
+    // writer-side helpers, called with the shard's write_mutex held
+    size_t find_slot(Table* t, uint64_t hash, const std::string& key) const;
+    void evict_one(Shard& s);
+    void rebuild(Shard& s);
+    void retire(Node* n);
+};
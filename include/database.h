@@ -2,23 +2,101 @@
 #pragma once
 #include <string>
 #include <optional>
+#include <vector>
+#include <utility>
+#include <string_view>
+#include <unordered_map>
+#include <cstddef>
 #include <libpq-fe.h>
+#include "storage.h"
 #include <mutex>
+#include <atomic>
+#include <cstdint>
 
-class Database {
+// A statement for Database::run_pipeline or AsyncDatabase; the key and
+// value must outlive it.
+struct DBOp {
+    enum class Kind { Put, Get, Remove };
+
+    Kind kind;
+    const std::string* key;
+    const std::string* value = nullptr;   // Put
+    bool ok = false;
+    std::optional<std::string> result;    // Get, empty when the key is absent
+};
+
+// One libpq connection. The put/get/remove statements are prepared once in
+// connect() and run with PQexecPrepared; values are bytea and travel in
+// binary format both ways, so they are neither escaped nor text-converted.
+class Database : public Storage {
 public:
     explicit Database(const std::string& conn_string);
-    ~Database();
+    ~Database() override;
     
-    bool connect();
-    bool put(const std::string& key, const std::string& value);
-    std::optional<std::string> get(const std::string& key);
-    bool remove(const std::string& key);
+    // opens the session and prepares the statements; the table must exist
+    bool connect() override;
+    // Creates and migrates kv_store on a connection of its own. Run once
+    // at startup, before any session prepares statements against it.
+    static bool create_schema(const std::string& conn_string);
+    bool put(const std::string& key, const std::string& value) override;
+    bool get(const std::string& key, std::optional<std::string>& value) override;
+    bool remove(const std::string& key) override;
+
+    // Fetches every key in one SELECT ... WHERE key = ANY($1).
+    bool get_many(const std::vector<const std::string*>& keys,
+                  std::vector<std::optional<std::string>>& values) override;
+
+    // Sends every op in libpq pipeline mode followed by one sync, then reads
+    // the results back in order: n statements for one round trip. A failed
+    // statement aborts the ones behind it, which come back with ok = false.
+    // Returns false if the connection itself failed.
+    bool run_pipeline(DBOp* const* ops, size_t n);
+
+    // One transaction: every upsert in a single multi-row INSERT ... ON
+    // CONFLICT and every delete in a single DELETE ... = ANY.
+    bool write_batch(const std::vector<KeyValue>& upserts,
+                     const std::vector<const std::string*>& deletes) override;
+
+    // A server-side cursor in a read-only transaction.
+    bool scan_open(const std::string& prefix, const std::string& start, size_t limit) override;
+    bool scan_fetch(size_t n, std::vector<Row>& rows) override;
+    void scan_close() override;
+
+    // COPY (SELECT ...) TO STDOUT in binary format, partitioned on heap
+    // block ranges, each row handed over as it is read off the socket.
+    bool dump(const DumpFilter& filter, const RowSink& sink) override;
+
+    // A row in kv_meta, created on first use.
+    bool load_epoch(std::string& token) override;
+    bool store_epoch(const std::string& token) override;
+
+    DBStats stats() const override;
+
+    // For AsyncDatabase, which drives the connection itself once connected
+    // and never calls the blocking methods above.
+    PGconn* native_handle() { return conn_handle_; }
+    // PQresetStart / PQresetPoll: a reconnect the caller's loop drives
+    bool start_reset() { return PQresetStart(conn_handle_) == 1; }
+    PostgresPollingStatusType poll_reset() { return PQresetPoll(conn_handle_); }
+    // queues the statement preparations on a connection in pipeline mode;
+    // one result each comes back, ahead of the caller's next sync
+    bool send_prepares() { return prepare_statements(true); }
+    bool send_prepared(const DBOp& op);
+    static void read_result(DBOp& op, const PGresult* res);
+    void record(DBOp::Kind kind, uint64_t us) { timer_for(kind).record(us); }
     
 private:
     std::string conninfo_;
     PGconn* conn_handle_;
     std::mutex mutex_;
+    LatencyTimer put_timer_, get_timer_, remove_timer_, scan_timer_;
     
     bool execute(const std::string& query);
-};
\ No newline at end of file
+    bool execute_locked(const char* query);
+
+    // called with mutex_ held
+    bool reconnect_locked();
+    bool prepare_statements(bool send_only = false);
+    bool prepare(const char* name, const char* sql, int nparams, const Oid* types, bool send_only);
+    LatencyTimer& timer_for(DBOp::Kind kind);
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <string>
+#include "database.h"
+
+// Batching layer over a few Database connections in libpq pipeline mode.
+// Callers block in put/get/remove as with a pooled connection, but instead
+// of holding a connection they queue their statement; one sender thread per
+// connection takes whatever has queued up (up to kMaxBatch) and runs it as
+// a single pipeline round trip. Many workers therefore share one
+// connection with many statements in flight, and a small number of
+// connections keeps Postgres busy.
+class DBPipeline {
+public:
+    // bounds the bytes written before results are read back; the
+    // connection is in blocking mode, so this keeps both sides' socket
+    // buffers from filling up against each other
+    static constexpr size_t kMaxBatch = 128;
+
+    DBPipeline(const std::string& conninfo, size_t num_connections);
+    ~DBPipeline();
+
+    bool is_connected() const { return connected_; }
+
+    bool put(const std::string& key, const std::string& value);
+    // as Database::get: false on failure, value empty when key is absent
+    bool get(const std::string& key, std::optional<std::string>& value);
+    bool remove(const std::string& key);
+
+    DBStats stats() const;
+    uint64_t batches() const { return batches_.load(std::memory_order_relaxed); }
+    uint64_t batched_queries() const { return batched_.load(std::memory_order_relaxed); }
+
+private:
+    struct Pending {
+        DBOp op;
+        bool done = false;
+        std::condition_variable cv;
+    };
+
+    std::vector<std::unique_ptr<Database>> conns_;
+    std::vector<std::thread> senders_;
+    std::deque<Pending*> queue_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+    bool connected_ = false;
+    std::atomic<uint64_t> batches_{0};
+    std::atomic<uint64_t> batched_{0};
+
+    void submit(Pending& p);
+    void sender_loop(Database& db);
+};
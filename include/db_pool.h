@@ -3,25 +3,68 @@
 #include <memory>
 #include <mutex>
 #include <condition_variable>
+#include <unordered_map>
+#include <atomic>
+#include <chrono>
 #include <string>
-#include "database.h"  // your existing Database class
+#include <functional>
+#include "storage.h"
 
+// Free connections sit on a lock-free stack of indices (Treiber stack with
+// a tag in the head word against ABA), so acquire and release are O(1)
+// CASes. Only a caller that finds the stack empty takes a mutex to sleep.
+//
+// With affinity on, a thread first tries the connection it used last; the
+// stack is then only a hint and each connection's busy flag decides who
+// owns it. listed says whether the index is currently on the stack, so a
+// release never pushes it twice.
+//
+// The sessions come from open(): Postgres connections, or sessions on the
+// embedded engine, which the pool then simply bounds in number.
 class DBConnectionPool {
 public:
-    DBConnectionPool(const std::string& conninfo, size_t pool_size);
+    using Opener = std::function<std::unique_ptr<Storage>()>;
 
-    // get a DB connection (blocks if all are busy)
-    Database* acquire();
+    DBConnectionPool(const Opener& open, size_t pool_size, bool affinity = false);
+
+    // get a DB connection; nullptr if none frees up within timeout
+    // (zero waits as long as it takes)
+    Storage* acquire(std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
 
     // return a connection to the pool
-    void release(Database* db);
+    void release(Storage* db);
 
     bool is_connected() const { return connected_; }
 
+    // query latencies summed over every connection
+    DBStats stats() const;
+    uint64_t timeouts() const { return timeouts_.load(std::memory_order_relaxed); }
+    uint64_t affinity_hits() const { return affinity_hits_.load(std::memory_order_relaxed); }
+
 private:
-    std::vector<std::unique_ptr<Database>> conns_;
-    std::vector<bool> in_use_;
-    mutable std::mutex mtx_;
-    std::condition_variable cv_;
+    static constexpr uint32_t kNil = 0;   // stack links are index + 1
+
+    struct alignas(64) Slot {
+        std::atomic<bool> busy{false};
+        std::atomic<bool> listed{false};
+        std::atomic<uint32_t> next{kNil};
+    };
+
+    std::vector<std::unique_ptr<Storage>> conns_;
+    std::unique_ptr<Slot[]> slots_;
+    std::unordered_map<const Storage*, size_t> index_of_;
+    std::atomic<uint64_t> head_{0};       // tag << 32 | (index + 1)
+    bool affinity_;
     bool connected_ = false;
+
+    std::mutex wait_mtx_;
+    std::condition_variable cv_;
+    std::atomic<size_t> waiters_{0};
+
+    std::atomic<uint64_t> timeouts_{0};
+    std::atomic<uint64_t> affinity_hits_{0};
+
+    void push(size_t i);
+    bool pop(size_t& i);
+    bool try_acquire(size_t& i);
 };
@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Epoch-based reclamation for structures that readers walk without a lock.
+// A reader pins the current epoch for the duration of its lookup; memory a
+// writer unlinks is retired and only freed once every pinned reader has
+// moved past the epoch it was retired in.
+class EpochManager {
+public:
+    static EpochManager& instance();
+
+    // RAII pin for a lock-free read section
+    class Guard {
+    public:
+        Guard();
+        ~Guard();
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    private:
+        size_t slot_;
+    };
+
+    // defer free until no reader can still see the object
+    void retire(std::function<void()> deleter);
+
+private:
+    static constexpr size_t kMaxThreads = 512;
+    static constexpr size_t kCollectEvery = 64;
+
+    struct alignas(64) ThreadSlot {
+        std::atomic<uint64_t> epoch{0};   // 0 = not inside a read section
+        std::atomic<bool> claimed{false};
+    };
+
+    struct Retired {
+        uint64_t epoch;
+        std::function<void()> deleter;
+    };
+
+    std::atomic<uint64_t> global_epoch_{1};
+    ThreadSlot slots_[kMaxThreads];
+
+    std::mutex retire_mutex_;
+    std::vector<Retired> retired_;
+    size_t since_collect_ = 0;
+
+    EpochManager() = default;
+
+    size_t claim_slot();
+    void release_slot(size_t slot);
+    void try_advance();
+    void collect();
+
+    friend struct ThreadSlotOwner;
+};
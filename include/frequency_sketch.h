@@ -0,0 +1,29 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Approximate access frequency for TinyLFU admission: a 4-row Count-Min
+// sketch of 4-bit counters behind a Bloom-filter doorkeeper that absorbs
+// one-hit wonders. Counters are halved every ~10x capacity increments so
+// old popularity fades. Not thread-safe; callers hold their shard lock.
+class FrequencySketch {
+public:
+    explicit FrequencySketch(size_t capacity);
+
+    void increment(uint64_t hash);
+    uint32_t estimate(uint64_t hash) const;
+
+private:
+    std::vector<uint64_t> table_;       // 16 four-bit counters per word
+    std::vector<uint64_t> doorkeeper_;  // 64 bits per word
+    size_t counter_mask_;
+    size_t door_mask_;
+    size_t sample_size_;
+    size_t additions_ = 0;
+
+    static uint64_t mix(uint64_t hash, int row);
+    bool door_contains(uint64_t hash) const;
+    bool door_insert(uint64_t hash);   // returns true if it was already present
+    void reset();
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+// Incremental HTTP/1.1 request parser. parse() is called with the whole
+// buffered request each time more bytes arrive and resumes where the last
+// call stopped, so no byte is scanned twice. Line ends are found with SSE2.
+// Nothing is copied or allocated: the accessors return views into the
+// buffer passed to the last parse() call, so they stay valid only while
+// that buffer is left untouched.
+class HttpParser {
+public:
+    enum class Status { Incomplete, Done, Error };
+
+    static constexpr size_t kMaxHeaderBytes = 64 * 1024;
+    static constexpr size_t kMaxBodyBytes = 64 * 1024 * 1024;
+    static constexpr size_t kMaxHeaders = 32;
+
+    Status parse(const char* data, size_t len);
+    void reset();
+
+    // valid once parse() returned Done
+    std::string_view method() const { return view(method_); }
+    std::string_view path() const { return view(path_); }
+    std::string_view body() const { return view(body_); }
+    std::string_view header(std::string_view name) const;   // case-insensitive
+    bool keep_alive() const { return keep_alive_; }
+    size_t consumed() const { return body_.off + body_.len; }
+
+private:
+    struct Span {
+        uint32_t off = 0;
+        uint32_t len = 0;
+    };
+    struct Header {
+        Span name;
+        Span value;
+    };
+    enum class State { RequestLine, Headers, Body };
+
+    const char* data_ = nullptr;
+    State state_ = State::RequestLine;
+    size_t line_start_ = 0;
+    size_t scan_pos_ = 0;
+
+    Span method_, path_, body_;
+    Header headers_[kMaxHeaders];
+    size_t header_count_ = 0;
+    size_t content_length_ = 0;
+    bool has_content_length_ = false;
+    bool keep_alive_ = true;
+
+    std::string_view view(Span s) const { return {data_ + s.off, s.len}; }
+    bool parse_request_line(size_t end);
+    bool parse_header_line(size_t end);
+};
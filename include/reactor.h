@@ -0,0 +1,165 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include <deque>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+#include "http_parser.h"
+#include "binary_protocol.h"
+
+// Views into the connection's input buffer; they stay valid until the
+// response for this request is passed to Reactor::complete().
+struct HttpRequest {
+    std::string_view method;
+    std::string_view path;
+    std::string_view body;
+    bool keep_alive = true;
+    // from the binary listener: method is GET, PUT, DELETE or MGET, path
+    // is the bare key, and the response must be in binproto framing
+    bool binary = false;
+};
+
+// A response as scatter-gather pieces: head (status, headers and any body
+// prefix), a shared value buffer that is written straight from where the
+// cache keeps it, and a tail.
+struct HttpResponse {
+    std::string head;
+    std::shared_ptr<const std::string> value;
+    std::string tail;
+
+    size_t size() const { return head.size() + (value ? value->size() : 0) + tail.size(); }
+};
+
+class Reactor;
+
+// Identifies a connection across threads. The id guards against the fd
+// being closed and reused by a new client while a worker still holds it.
+struct ConnHandle {
+    Reactor* reactor;
+    int fd;
+    uint64_t id;
+};
+
+// Non-blocking epoll loop that owns the listening socket and every client
+// socket. Only complete requests leave the loop; workers hand the response
+// back through complete() and the loop does the write.
+//
+// Pipelined clients: every complete request already buffered on a
+// connection (up to kMaxPipeline) is handed over as one batch, to be run in
+// order, and the batch's responses are written together with one sendmsg.
+class Reactor {
+public:
+    static constexpr size_t kMaxPipeline = 64;
+
+    using RequestBatch = std::vector<HttpRequest>;
+    using RequestHandler = std::function<void(const ConnHandle&, RequestBatch)>;
+
+    Reactor(int listen_fd, RequestHandler handler);
+    ~Reactor();
+
+    // also accept clients speaking binproto on fd; call before run()
+    void listen_binary(int fd);
+
+    // runs the loop on the calling thread until stop(), which may come first
+    void run();
+    void stop();
+
+    // thread-safe: queue the responses to a batch, one per request in order
+    void complete(const ConnHandle& conn, std::vector<HttpResponse> responses, bool keep_alive);
+
+    // thread-safe: queue responses ahead of the rest of a batch that is
+    // still running, such as the chunks of a streamed body. on_drained runs
+    // on the loop thread once they are all written (true) or the client is
+    // gone (false); nothing more should be queued before then. Once run()
+    // has returned it runs at once, with false, on the calling thread. The batch
+    // still ends with complete(), and its request views stay valid until
+    // then even if the client disconnects.
+    using DrainHandler = std::function<void(bool alive)>;
+    void send_partial(const ConnHandle& conn, std::vector<HttpResponse> responses, DrainHandler on_drained);
+
+    // thread-safe: run task on the loop thread
+    void post(std::function<void()> task);
+
+    // Extra descriptors (e.g. database sockets) polled by the loop; the
+    // handler gets the epoll events. Loop thread only, or before run().
+    using FdHandler = std::function<void(uint32_t events)>;
+    void watch(int fd, uint32_t events, FdHandler handler);
+    void rewatch(int fd, uint32_t events);
+    void unwatch(int fd);
+
+    size_t connection_count() const { return open_conns_.load(); }
+
+private:
+    // Per-connection input bytes, reused across requests. Reads land
+    // directly in the spare capacity; consumed requests are shifted out.
+    struct InputBuffer {
+        std::unique_ptr<char[]> data;
+        size_t cap = 0;
+        size_t len = 0;
+
+        char* reserve(size_t n);
+        void consume(size_t n);
+    };
+
+    struct Connection {
+        int fd;
+        uint64_t id;
+        InputBuffer in;
+        HttpParser parser;
+        bool binary = false;        // accepted on the binary listener
+        size_t in_flight = 0;       // bytes of the batch a worker is using
+        std::deque<HttpResponse> out;
+        size_t out_off = 0;         // bytes of out.front() already sent
+        uint32_t events = 0;        // current epoll interest
+        bool busy = false;          // batch is with a worker
+        bool peer_closed = false;   // read side hit EOF
+        bool close_after_write = false;
+        DrainHandler on_drained;    // a streaming worker waiting for out to empty
+        std::chrono::steady_clock::time_point last_active;
+    };
+
+    struct Completion {
+        ConnHandle conn;
+        std::vector<HttpResponse> responses;
+        bool keep_alive;
+        DrainHandler on_drained;    // set for send_partial()
+    };
+
+    int listen_fd_;
+    int binary_fd_ = -1;
+    int epoll_fd_;
+    int wake_fd_;
+    std::atomic<bool> running_{true};   // cleared by stop(), even before run()
+    std::atomic<size_t> open_conns_{0};
+    uint64_t next_id_ = 1;
+    RequestHandler handler_;
+
+    std::unordered_map<int, std::unique_ptr<Connection>> conns_;
+    // closed while a worker still holds views into their buffer; freed by
+    // the batch's complete(). Keyed by id, as the fd may be reused.
+    std::unordered_map<uint64_t, std::unique_ptr<Connection>> closing_;
+    std::unordered_map<int, FdHandler> watchers_;
+
+    std::mutex done_mutex_;
+    bool stopped_ = false;          // run() has returned; guarded by done_mutex_
+    std::vector<Completion> done_;
+    std::vector<std::function<void()>> posted_;
+
+    void accept_ready(int listen_fd);
+    void read_ready(Connection& c);
+    void drain_completions();
+    bool flush(Connection& c);
+    void dispatch(Connection& c);
+    bool parse_binary(Connection& c, RequestBatch& batch, size_t& off);
+    void settle(Connection& c);
+    void update_interest(Connection& c);
+    void close_conn(int fd);
+    void notify_drained(Connection& c, bool alive);
+    void sweep_idle();
+};
@@ -1,37 +1,223 @@
 #pragma once
 #include <memory>
 #include <atomic>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <condition_variable>
 #include "threadpool.h"
 #include "cache.h"
+#include "clock_cache.h"
+#include "slab_cache.h"
 #include "database.h"
+#include "bitcask.h"
 #include "db_pool.h"
+#include "db_pipeline.h"
+#include "async_db.h"
+#include "write_behind.h"
+#include "single_flight.h"
+#include "reactor.h"
+
+
+struct ServerConfig {
+    int port = 8080;
+    // second listener speaking binproto (see binary_protocol.h) on the
+    // same reactors, cache and pool (0 = HTTP only)
+    int binary_port = 0;
+    size_t num_threads = 4;
+    size_t cache_capacity = 100;
+    size_t cache_shards = 16;
+    std::string cache_engine = "lru";   // "lru", "clock" or "slab"
+    size_t cache_bytes = 64 << 20;      // memory budget for the slab engine
+    bool cache_tinylfu = false;         // W-TinyLFU admission (lru engine)
+    // "postgres", or "bitcask" for the embedded log in bitcask.dir; the
+    // pipelined and async DB modes are Postgres-only
+    std::string storage = "postgres";
+    Bitcask::Options bitcask;
+    std::string db_conn_string;
+    size_t db_pool_size = 16;
+    bool db_pool_affinity = false;      // workers reuse the connection they had last
+    size_t db_acquire_timeout_ms = 0;   // 503 after waiting this long (0 = wait)
+    // connections shared in libpq pipeline mode; 0 runs statements on the pool
+    size_t db_pipeline_conns = 0;
+    // nonblocking connections per reactor; requests park instead of
+    // blocking a worker while Postgres answers (0 = blocking calls)
+    size_t db_async_conns = 0;
+    // write-behind: PUT/DELETE reply once cached and are flushed to
+    // Postgres every write_behind_ms in batches of up to write_behind_batch
+    // (0 = write-through)
+    size_t write_behind_ms = 0;
+    size_t write_behind_batch = 500;
+    // how long shutdown keeps retrying a failing final flush
+    size_t write_behind_drain_ms = 30000;
+    // answer cache hits on the reactor thread; only misses and writes are
+    // handed to the worker pool (num_threads), which then does nothing but
+    // wait on Postgres
+    bool fast_lane = true;
+    // load shedding: a request still queued for a worker after
+    // latency_budget_ms, or that would wait longer than what is left of it
+    // for a pooled connection, gets 503 + Retry-After (0 = no budget)
+    size_t latency_budget_ms = 0;
+    // most batches waiting for a worker before new ones are shed (0 = no limit)
+    size_t max_pending = 0;
+    // warm restarts (see cache_snapshot.h): the cache is loaded from
+    // snapshot_path at startup and written back there on shutdown and,
+    // with snapshot_interval_s, that often while running ("" = off)
+    std::string snapshot_path;
+    size_t snapshot_interval_s = 0;
+    // prewarm: before the listeners open, load up to prewarm_rows rows
+    // (0 = no limit), the rows under prewarm_prefix, or the keys listed in
+    // prewarm_keys_file into the cache, over prewarm_conns pooled
+    // connections at once
+    size_t prewarm_rows = 0;
+    std::string prewarm_prefix;
+    std::string prewarm_keys_file;
+    size_t prewarm_conns = 4;
+
+    // number of listener+epoll loops; more than one binds each with SO_REUSEPORT
+    size_t reactors = 1;
+    // optional core per loop (loop i runs on reactor_cores[i % size])
+    std::vector<int> reactor_cores;
+};
 
 
 class HTTPServer {
 public:
-    HTTPServer(int port, size_t num_threads, size_t cache_capacity,
-           const std::string& db_conn_string, size_t db_pool_size = 16);
-;
+    explicit HTTPServer(const ServerConfig& config);
     ~HTTPServer();
     
+    // runs until request_stop(); call stop() once it returns
     void start();
+    // flushes write-behind, snapshots the cache and closes the store; not
+    // for signal handlers
     void stop();
+    // async-signal-safe: makes start() return
+    void request_stop();
     
 private:
+    // A request that needs Postgres, between the cache step and the response.
+    struct DBRequest {
+        std::string key;
+        CacheValue stored;        // PUT: the body, cached once written
+        DBOp op;
+        DBStatus status = DBStatus::Ok;
+        std::chrono::milliseconds acquire_timeout{0};   // for a pooled connection
+        uint64_t since = 0;       // write-behind version() before the lookup
+
+        // _mget / _mput: always run on a pooled connection
+        bool multi = false;
+        std::vector<std::string> keys;
+        std::vector<CacheValue> values;   // _mget: hits, then what was fetched
+        std::vector<size_t> missing;      // _mget: indices still to fetch
+        size_t hits = 0;
+
+        // GET /kv?prefix=&start=&limit=: streamed from a cursor on a pooled
+        // connection
+        bool scan = false;
+        std::string scan_prefix;
+        std::string scan_start;
+        size_t scan_limit = 0;
+        size_t scan_sent = 0;     // rows streamed so far
+        // write-behind: the writes in range not yet flushed, merged into
+        // the rows (see merge_pending()); scan_next is the first not sent
+        std::map<std::string, CacheValue> scan_pending;
+        std::map<std::string, CacheValue>::const_iterator scan_next;
+    };
+
+    // One connection's pipelined requests, carried across worker threads
+    // while a statement is out.
+    struct BatchState {
+        ConnHandle conn;
+        Reactor::RequestBatch batch;
+        std::vector<HttpResponse> responses;
+        DBRequest db;
+        SingleFlight::Result flight;   // set while resuming behind another fetch
+        bool prepared = false;         // db already filled in for the next request
+        std::chrono::steady_clock::time_point handed_off;   // to the worker pool
+        size_t sent = 0;               // responses already streamed out ahead of the rest
+        Storage* scan_conn = nullptr;  // holds the open cursor of a scan
+
+        // index of the request being worked on
+        size_t next() const { return sent + responses.size(); }
+    };
+
+    ServerConfig config_;
     int listen_port_;
-    int listen_fd_;
+    std::chrono::milliseconds db_timeout_;
+    std::chrono::milliseconds latency_budget_;
+    std::vector<int> listen_fds_;
     std::atomic<bool> running_{false};
+    int stop_fd_ = -1;   // eventfd written by request_stop(), watched by reactor 0
     
-    std::unique_ptr<ThreadPool> thread_pool_;
-    std::unique_ptr<LRUCache> cache_;
+    std::vector<std::unique_ptr<Reactor>> reactors_;
+    std::vector<std::thread> reactor_threads_;
+    std::unique_ptr<Cache> cache_;
+    std::unique_ptr<Bitcask> bitcask_;   // outlives the sessions below
     std::unique_ptr<DBConnectionPool> db_pool_;
+    std::unique_ptr<DBPipeline> db_pipeline_;
+    std::unique_ptr<WriteBehind> write_behind_;
+    SingleFlight flights_;
+    // per reactor, parallel to reactors_; destroyed before them
+    std::vector<std::vector<std::unique_ptr<AsyncDatabase>>> async_dbs_;
+    // after everything its tasks use, so it is destroyed (drained) first
+    std::unique_ptr<ThreadPool> thread_pool_;
+    // per-request time on the fast lane; per-batch queue wait and total
+    // time on the slow lane
+    LatencyTimer fast_lane_timer_;
+    LatencyTimer slow_lane_wait_;
+    LatencyTimer slow_lane_timer_;
+    std::atomic<size_t> slow_lane_pending_{0};
+    std::atomic<uint64_t> shed_queue_full_{0};
+    std::atomic<uint64_t> shed_deadline_{0};
+    std::atomic<uint64_t> scans_{0};
+    std::atomic<uint64_t> scan_rows_{0};
+
+    // Cache snapshots. Writes count themselves in writes_in_flight_; one
+    // that starts while snapshot_gate_ is up voids the snapshot being
+    // taken or retires the one on disk (see begin_write()).
+    std::mutex snapshot_mtx_;
+    std::condition_variable snapshot_cv_;
+    bool snapshot_stop_ = false;    // these three guarded by snapshot_mtx_
+    bool snapshot_dirty_ = false;   // a write started during the current one
+    bool snapshot_live_ = false;    // the file on disk still holds for the store
+    std::atomic<bool> snapshot_gate_{false};
+    std::atomic<size_t> writes_in_flight_{0};
+    std::atomic<uint64_t> snapshots_written_{0};
+    std::atomic<uint64_t> snapshots_dropped_{0};
+    std::thread snapshot_thread_;
 
     
-    void accept_loop();
-    void handle_client(int client_fd);
-    
-    void parse_http_request(const std::string& request, 
-                           std::string& method, 
-                           std::string& path,
-                           std::string& body);
+    int open_listener(int port, bool reuse_port);
+    void run_reactor(size_t index);
+    void on_request(const ConnHandle& conn, Reactor::RequestBatch batch);
+    bool run_fast_lane(BatchState* st);
+    void run_batch(BatchState* st);
+    void shed(BatchState* st);
+    std::chrono::milliseconds acquire_timeout(const BatchState* st) const;
+    AsyncDatabase& async_db_for(Reactor* loop);
+    bool begin_request(const HttpRequest& req, DBRequest& db, HttpResponse& resp);
+    HttpResponse finish_request(const HttpRequest& req, DBRequest& db);
+    void fill_cache(const std::string& key, const CacheValue& value, uint64_t since);
+    HttpResponse miss_response(const HttpRequest& req, const SingleFlight::Result& r);
+    void run_db_sync(DBRequest& db);
+    HttpResponse db_error_response(const HttpRequest& req, DBStatus status, const char* headers);
+    DBStatus db_put(const std::string& key, const std::string& value, std::chrono::milliseconds timeout);
+    DBStatus db_get(const std::string& key, std::optional<std::string>& value,
+                    std::chrono::milliseconds timeout);
+    DBStatus db_remove(const std::string& key, std::chrono::milliseconds timeout);
+    bool begin_multi(const HttpRequest& req, bool put, DBRequest& db, HttpResponse& resp);
+    HttpResponse finish_multi(const HttpRequest& req, DBRequest& db);
+    void run_multi_sync(DBRequest& db);
+    bool start_scan(BatchState* st);
+    void scan_step(BatchState* st, bool alive);
+    static void merge_pending(DBRequest& db, std::vector<Storage::Row>& rows, bool exhausted);
+    void begin_write();
+    void end_write();
+    void prewarm();
+    void load_snapshot();
+    bool take_snapshot(size_t &entries);
+    void snapshot_loop();
+    std::string stats_report() const;
 };
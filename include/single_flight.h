@@ -0,0 +1,45 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include "cache.h"
+#include "database.h"
+
+// Coalesces concurrent cache misses on one key: the first miss becomes the
+// leader and fetches from Postgres, later misses queue a callback on the
+// leader's flight and are answered from its result. A key that goes hot
+// while uncached costs one SELECT instead of one per waiting request.
+class SingleFlight {
+public:
+    struct Result {
+        DBStatus status;
+        CacheValue value;    // nullptr: no such key
+    };
+    using Waiter = std::function<void(const Result&)>;
+
+    // true: no fetch of key is in flight and the caller must do it, then
+    // call finish(); false: waiter runs when the current one finishes
+    bool join(const std::string& key, Waiter waiter);
+    // ends the flight and runs its waiters on the calling thread
+    void finish(const std::string& key, const Result& result);
+
+    uint64_t coalesced() const { return coalesced_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t kShards = 16;
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::vector<Waiter>> flights;
+    };
+
+    Shard shards_[kShards];
+    std::atomic<uint64_t> coalesced_{0};
+
+    Shard& shard_for(const std::string& key) {
+        return shards_[std::hash<std::string>{}(key) % kShards];
+    }
+};
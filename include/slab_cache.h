@@ -0,0 +1,87 @@
+#pragma once
+#include "cache.h"
+#include <cstdint>
+
+// Byte-budgeted cache engine in the style of memcached's slab allocator.
+// Memory is taken from the budget in fixed 1MB pages; each page is given to
+// one size class and cut into equal chunks that hold an item header, the key
+// and the value back to back. Every class keeps its own LRU, so when the
+// budget is spent a put evicts from the class it needs a chunk in. Nothing
+// is malloc'd per entry; the flip side is that a hit copies the value out
+// of its chunk into a fresh shared buffer (slab_hit_copy_bytes in /stats).
+//
+// Pages are not pinned to the class that first took them: when a class has
+// evicted a page's worth of items since the last check, the shard moves the
+// page holding the coldest item of the class that evicted the fewest bytes
+// over to it, so memory follows the value sizes the workload writes now.
+class SlabCache : public Cache {
+public:
+    static constexpr size_t kPageSize = 1 << 20;
+
+    SlabCache(size_t budget_bytes, size_t num_shards);
+
+    CacheValue get(const std::string& key) override;
+    void put(const std::string& key, CacheValue value) override;
+    void remove(const std::string& key) override;
+    size_t size() const override;
+    CacheStats stats() const override;
+    std::string engine_report() const override;
+    // each class's LRU from the tail; values are copied out of their chunks
+    void entries(std::vector<Entry>& out) const override;
+
+private:
+    struct Item {
+        Item* lru_prev;
+        Item* lru_next;
+        Item* hash_next;
+        uint64_t hash;
+        uint32_t value_len;
+        uint16_t key_len;
+        uint8_t cls;            // kFree on a free chunk
+
+        char* key() { return reinterpret_cast<char*>(this + 1); }
+        char* value() { return key() + key_len; }
+    };
+
+    static constexpr uint8_t kFree = UINT8_MAX;
+
+    struct SlabClass {
+        size_t chunk_size = 0;
+        size_t pages = 0;
+        size_t used = 0;            // chunks holding an item
+        size_t evictions = 0;
+        size_t recent_evictions = 0;   // since the shard last checked for a page move
+        Item* free_list = nullptr;  // linked through lru_next
+        Item* lru_head = nullptr;
+        Item* lru_tail = nullptr;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::vector<SlabClass> classes;
+        std::vector<std::unique_ptr<char[]>> pages;
+        size_t page_limit = 0;
+        std::vector<Item*> buckets;
+        size_t count = 0;
+        CacheStats stats;
+        uint64_t hit_copy_bytes = 0;
+        uint64_t page_moves = 0;
+    };
+
+    std::vector<size_t> class_sizes_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    size_t budget_bytes_;
+
+    Shard& shard_for(uint64_t hash);
+    int class_for(size_t bytes) const;
+
+    // called with the shard lock held
+    Item* find(Shard& s, uint64_t hash, const std::string& key);
+    Item* alloc_chunk(Shard& s, int cls);
+    void carve_page(SlabClass& c, char* page);
+    bool move_page(Shard& s, int cls);
+    void unlink(Shard& s, Item* it);
+    void lru_push_front(SlabClass& c, Item* it);
+    void lru_unlink(SlabClass& c, Item* it);
+    void grow_buckets(Shard& s);
+};
@@ -0,0 +1,109 @@
+#pragma once
+#include <string>
+#include <optional>
+#include <vector>
+#include <utility>
+#include <atomic>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+// Round-trip time of the statements a connection has run, per kind.
+struct QueryStats {
+    uint64_t count = 0;
+    uint64_t total_us = 0;
+    uint64_t max_us = 0;
+
+    QueryStats& operator+=(const QueryStats& o) {
+        count += o.count;
+        total_us += o.total_us;
+        if (o.max_us > max_us) max_us = o.max_us;
+        return *this;
+    }
+};
+
+// Lock-free accumulator behind a QueryStats, safe to record from any thread.
+struct LatencyTimer {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> total_us{0};
+    std::atomic<uint64_t> max_us{0};
+
+    void record(uint64_t us);
+    QueryStats load() const;
+};
+
+struct DBStats {
+    QueryStats put, get, remove;
+    QueryStats scan;   // one per scan_fetch chunk
+
+    DBStats& operator+=(const DBStats& o) {
+        put += o.put; get += o.get; remove += o.remove; scan += o.scan;
+        return *this;
+    }
+};
+
+// How a statement ended up, as far as the HTTP layer cares.
+enum class DBStatus {
+    Ok,            // ran (possibly failing at the SQL level)
+    Busy,          // no connection freed up in time; worth retrying
+    Unavailable,   // the connection failed
+};
+
+// The backing store as the server sees it: one session, used by one
+// thread at a time through DBConnectionPool or WriteBehind. Database
+// speaks to Postgres; BitcaskStore is a session on the embedded log.
+class Storage {
+public:
+    virtual ~Storage() = default;
+
+    virtual bool connect() = 0;
+    virtual bool put(const std::string& key, const std::string& value) = 0;
+    // value is left empty when key is absent; false on failure
+    virtual bool get(const std::string& key, std::optional<std::string>& value) = 0;
+    virtual bool remove(const std::string& key) = 0;
+
+    // values[i] is left empty when keys[i] is absent; false on failure
+    virtual bool get_many(const std::vector<const std::string*>& keys,
+                          std::vector<std::optional<std::string>>& values) = 0;
+
+    // Applies every upsert and delete as one unit. Keys must be unique
+    // across the batch.
+    using KeyValue = std::pair<const std::string*, const std::string*>;
+    virtual bool write_batch(const std::vector<KeyValue>& upserts,
+                             const std::vector<const std::string*>& deletes) = 0;
+
+    // Cursor over the keys that start with prefix, from start on, in key
+    // order, at most limit rows (0 = no limit). It holds this session
+    // until scan_close().
+    using Row = std::pair<std::string, std::string>;
+    virtual bool scan_open(const std::string& prefix, const std::string& start, size_t limit) = 0;
+    // next rows off the cursor; none once it is exhausted
+    virtual bool scan_fetch(size_t n, std::vector<Row>& rows) = 0;
+    virtual void scan_close() = 0;
+
+    // Rows to stream out with dump(): those whose key starts with prefix
+    // and, if keys is set, is one of the num_keys listed, that fall in
+    // partition part of parts; at most limit (0 = all). Each backend
+    // splits its data its own way, so that a part costs about its share.
+    struct DumpFilter {
+        std::string prefix;
+        const std::string* keys = nullptr;
+        size_t num_keys = 0;
+        uint32_t part = 0;
+        uint32_t parts = 1;
+        size_t limit = 0;
+    };
+    using RowSink = std::function<void(std::string key, std::string value)>;
+    // Bulk read for filling the cache, in no particular order. Disjoint
+    // partitions can be dumped on separate sessions at once. Not counted
+    // in stats(), which tracks per-request latency.
+    virtual bool dump(const DumpFilter& filter, const RowSink& sink) = 0;
+
+    // Token naming the cache snapshot last taken against this data (see
+    // cache_snapshot.h), kept with the data so a snapshot is only loaded
+    // back onto the store it came from. Empty when there is none.
+    virtual bool load_epoch(std::string& token) = 0;
+    virtual bool store_epoch(const std::string& token) = 0;
+
+    virtual DBStats stats() const = 0;
+};
@@ -1,26 +1,131 @@
 #pragma once
 #include <vector>
-#include <queue>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <functional>
 #include <atomic>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
 
+// A callable stored inline: a function pointer plus up to kCaptureBytes of
+// captured state, with no heap allocation. The capture must be trivially
+// copyable (pointers, integers) so a task can be copied word by word
+// through the lock-free deques without running constructors.
+class Task {
+public:
+    static constexpr size_t kCaptureBytes = 32;
+
+    Task() = default;
+
+    template <class F, class = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task>>>
+    Task(F f) {
+        static_assert(sizeof(F) <= kCaptureBytes, "task capture too large");
+        static_assert(std::is_trivially_copyable_v<F>, "task capture must be trivially copyable");
+        std::memcpy(capture_, &f, sizeof(F));
+        run_ = [](unsigned char* capture) { (*reinterpret_cast<F*>(capture))(); };
+    }
+
+    void operator()() { run_(capture_); }
+    explicit operator bool() const { return run_ != nullptr; }
+
+private:
+    void (*run_)(unsigned char*) = nullptr;
+    alignas(8) unsigned char capture_[kCaptureBytes];
+};
+
+struct ThreadPoolStats {
+    uint64_t executed = 0;
+    uint64_t steals = 0;      // tasks taken from another worker's deque
+    uint64_t injected = 0;    // tasks submitted from outside the pool
+    uint64_t parks = 0;       // times a worker found nothing and slept
+    size_t queue_depth = 0;   // tasks waiting right now
+};
+
+// Work-stealing executor. Each worker owns a Chase-Lev deque: tasks it
+// submits itself go to the bottom of its own deque and it pops them back
+// LIFO without any lock, while idle workers steal from the top. Tasks from
+// other threads (reactors, DB callbacks) go through a bounded lock-free
+// injection queue. A worker that finds nothing spins briefly, then parks
+// on a condition variable that submitters only touch when someone sleeps.
 class ThreadPool {
 public:
     explicit ThreadPool(size_t num_threads);
     ~ThreadPool();
-    
-    void enqueue(std::function<void()> task);
-    
+
+    void enqueue(Task task);
+    // runs every queued task, including ones they queue in turn, then
+    // joins the workers; tasks enqueued from outside afterwards never run
+    void shutdown();
+    ThreadPoolStats stats() const;
+
 private:
+    static constexpr size_t kWords = sizeof(Task) / sizeof(uint64_t);
+    static_assert(sizeof(Task) % sizeof(uint64_t) == 0 && std::is_trivially_copyable_v<Task>);
+
+    // Single-owner deque of fixed capacity. Slots are atomic words so a
+    // thief reading a slot the owner is overwriting is a benign race that
+    // the CAS on top_ then rejects.
+    class Deque {
+    public:
+        static constexpr int64_t kCapacity = 4096;
+
+        bool push(const Task& t);   // owner only; false when full
+        bool pop(Task& t);          // owner only
+        bool steal(Task& t);        // any thread
+        size_t size() const;
+
+    private:
+        struct Slot { std::atomic<uint64_t> w[kWords]; };
+        alignas(64) std::atomic<int64_t> top_{0};
+        alignas(64) std::atomic<int64_t> bottom_{0};
+        std::unique_ptr<Slot[]> slots_{new Slot[kCapacity]};
+
+        void store(int64_t i, const Task& t);
+        Task load(int64_t i) const;
+    };
+
+    // Bounded multi-producer multi-consumer ring (Vyukov): each cell's
+    // sequence number says whether it is ready to be written or read.
+    class InjectQueue {
+    public:
+        static constexpr size_t kCapacity = 1 << 16;
+
+        InjectQueue();
+        bool push(const Task& t);
+        bool pop(Task& t);
+        size_t size() const;
+
+    private:
+        struct Cell {
+            std::atomic<size_t> seq;
+            Task task;
+        };
+        std::unique_ptr<Cell[]> cells_;
+        alignas(64) std::atomic<size_t> head_{0};
+        alignas(64) std::atomic<size_t> tail_{0};
+    };
+
+    struct alignas(64) Worker {
+        Deque deque;
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> steals{0};
+        std::atomic<uint64_t> parks{0};
+    };
+
+    std::vector<std::unique_ptr<Worker>> queues_;
     std::vector<std::thread> workers_;
-    std::queue<std::function<void()>> tasks_;
-    
-    std::mutex queue_mutex_;
+    InjectQueue inject_;
+    std::atomic<uint64_t> injected_{0};
+
+    std::mutex park_mutex_;
     std::condition_variable cv_;
+    std::atomic<size_t> sleepers_{0};
+    std::atomic<uint64_t> wake_epoch_{0};
     std::atomic<bool> stopping_{false};
-    
-    void worker_loop();
+
+    void worker_loop(size_t index);
+    bool find_task(size_t index, Task& t);
+    void wake_one();
 };
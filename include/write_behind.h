@@ -0,0 +1,87 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include "cache.h"
+#include "storage.h"
+
+// Write-behind buffer for PUT and DELETE. Writes land in a dirty map keyed
+// by key, so repeated writes to one key collapse into the latest, and a
+// flusher thread drains it to the backing store every interval (or as soon
+// as a full batch is waiting) with one write_batch() per flush: for
+// Postgres, one multi-row upsert and one delete per transaction. Until its
+// flush commits, a dirty entry is answered from this buffer, so it cannot
+// be lost to cache eviction and a read never sees the older row still in
+// the table. On stop() a failing store is retried, with backoff, until
+// drain_timeout runs out.
+class WriteBehind {
+public:
+    enum class Lookup { Absent, Found, Deleted };
+
+    struct Stats {
+        size_t dirty = 0;
+        uint64_t writes = 0;
+        uint64_t coalesced = 0;    // writes that replaced a pending one
+        uint64_t flushes = 0;      // committed transactions
+        uint64_t flushed_rows = 0;
+        uint64_t failures = 0;
+    };
+
+    WriteBehind(std::unique_ptr<Storage> store, std::chrono::milliseconds interval, size_t max_batch,
+                std::chrono::milliseconds drain_timeout);
+    ~WriteBehind();
+
+    bool is_connected() const { return connected_; }
+
+    // value nullptr records a delete; blocks while the buffer is full
+    void write(const std::string& key, CacheValue value);
+    Lookup lookup(const std::string& key, CacheValue& value) const;
+    // the pending writes to keys from start on that begin with prefix, in
+    // key order; a null value is a pending delete
+    std::map<std::string, CacheValue> pending(const std::string& prefix, const std::string& start) const;
+    // Cache fills race with writes: take version() before looking a key
+    // up, and once the value read is in the cache, written_since() says
+    // whether a write may have landed in between (it can be wrong only
+    // towards true).
+    uint64_t version() const;
+    bool written_since(const std::string& key, uint64_t since) const;
+
+    // flushes everything still dirty, then stops the flusher; false if
+    // some writes never reached the store
+    bool stop();
+    Stats stats() const;
+
+private:
+    struct Dirty {
+        CacheValue value;   // nullptr: delete
+        uint64_t seq;
+    };
+
+    std::unique_ptr<Storage> db_;
+    std::chrono::milliseconds interval_;
+    std::chrono::milliseconds drain_timeout_;
+    size_t max_batch_;
+    size_t max_dirty_;
+    bool connected_ = false;
+
+    std::unordered_map<std::string, Dirty> dirty_;
+    uint64_t next_seq_ = 0;
+    uint64_t flushed_seq_ = 0;   // newest write dropped from dirty_ by a flush
+    mutable std::mutex mtx_;
+    std::condition_variable flush_cv_;   // wakes the flusher
+    std::condition_variable room_cv_;    // wakes writers waiting for space
+    bool stopping_ = false;
+    std::chrono::steady_clock::time_point drain_deadline_;
+    std::thread flusher_;
+
+    Stats stats_;
+
+    void flusher_loop();
+    bool flush_batch();
+};
@@ -0,0 +1,243 @@
+#include "async_db.h"
+#include "reactor.h"
+#include <sys/epoll.h>
+#include <iostream>
+
+namespace {
+constexpr auto kReconnectInterval = std::chrono::seconds(1);
+// a handshake still unfinished after this is abandoned
+constexpr auto kReconnectTimeout = std::chrono::seconds(5);
+}
+
+AsyncDatabase::AsyncDatabase(const std::string& conninfo) : db_(conninfo) {}
+
+AsyncDatabase::~AsyncDatabase() {
+    if (loop_ && fd_ >= 0) loop_->unwatch(fd_);
+}
+
+bool AsyncDatabase::connect() {
+    return db_.connect() && enter_async_mode();
+}
+
+bool AsyncDatabase::enter_async_mode() {
+    PGconn* conn = db_.native_handle();
+    if (PQsetnonblocking(conn, 1) != 0 || !PQenterPipelineMode(conn)) {
+        std::cerr << "Async DB: cannot enter pipeline mode: " << PQerrorMessage(conn) << "\n";
+        return false;
+    }
+    return true;
+}
+
+void AsyncDatabase::attach(Reactor& loop) {
+    loop_ = &loop;
+    rearm(EPOLLIN);
+}
+
+void AsyncDatabase::submit(DBOp* op, Callback done) {
+    if (state_ != State::Ready && state_ != State::Broken &&
+        std::chrono::steady_clock::now() - last_reconnect_ > kReconnectTimeout) {
+        fail("reconnect timed out");
+    }
+    if (state_ == State::Broken) start_reconnect();
+    if (state_ == State::Broken) {
+        done(false);
+        return;
+    }
+    if (state_ != State::Ready) {
+        waiting_.push_back({op, std::move(done), std::chrono::steady_clock::now()});
+        return;
+    }
+    if (send(op, done)) flush();
+}
+
+void AsyncDatabase::abandon() {
+    if (in_flight() > 0) fail("shutting down");
+}
+
+// Sends one statement with its own sync; false (after failing the
+// connection) if libpq would not take it.
+bool AsyncDatabase::send(DBOp* op, Callback& done) {
+    if (!db_.send_prepared(*op) || !PQpipelineSync(db_.native_handle())) {
+        done(false);
+        fail("send failed");
+        return false;
+    }
+    inflight_.push_back({op, std::move(done), std::chrono::steady_clock::now()});
+    return true;
+}
+
+// Pushes buffered statements out; EPOLLOUT is only asked for while libpq
+// still holds unsent bytes.
+bool AsyncDatabase::flush() {
+    int r = PQflush(db_.native_handle());
+    if (r < 0) {
+        fail("flush failed");
+        return false;
+    }
+    bool want_write = (r == 1);
+    if (want_write != want_write_) {
+        want_write_ = want_write;
+        uint32_t events = EPOLLIN;
+        if (want_write) events |= EPOLLOUT;
+        rearm(events);
+    }
+    return true;
+}
+
+// Points the loop at libpq's current socket. A reset may replace it, even
+// under the same number, so during the handshake it is registered afresh.
+void AsyncDatabase::rearm(uint32_t events) {
+    int fd = PQsocket(db_.native_handle());
+    if (fd != fd_ || events_ == 0 || state_ == State::Connecting) {
+        if (fd_ >= 0 && events_ != 0) loop_->unwatch(fd_);
+        fd_ = fd;
+        events_ = 0;
+        if (fd_ < 0) return;
+        loop_->watch(fd_, events, [this](uint32_t ev) { on_ready(ev); });
+    } else if (events != events_) {
+        loop_->rewatch(fd_, events);
+    }
+    events_ = events;
+}
+
+void AsyncDatabase::on_ready(uint32_t events) {
+    if (state_ == State::Connecting) {
+        poll_reconnect();
+        return;
+    }
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        fail("connection lost");
+        return;
+    }
+    if ((events & EPOLLOUT) && !flush()) return;
+    if (events & EPOLLIN) {
+        if (!PQconsumeInput(db_.native_handle())) {
+            fail("read failed");
+            return;
+        }
+        if (state_ == State::Preparing) read_prepares();
+        else read_results();
+    }
+}
+// Each statement yields its result, a NULL, then the sync that closes it;
+// the callback runs at the sync. Stops as soon as libpq needs more input.
+void AsyncDatabase::read_results() {
+    PGconn* conn = db_.native_handle();
+    int nulls = 0;
+    while (!inflight_.empty() && !PQisBusy(conn)) {
+        PGresult* res = PQgetResult(conn);
+        if (!res) {
+            if (++nulls > 1) break;   // nothing more queued in libpq
+            continue;
+        }
+        nulls = 0;
+
+        InFlight& f = inflight_.front();
+        if (PQresultStatus(res) != PGRES_PIPELINE_SYNC) {
+            Database::read_result(*f.op, res);
+            PQclear(res);
+            continue;
+        }
+        PQclear(res);
+
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - f.sent).count();
+        db_.record(f.op->kind, static_cast<uint64_t>(us));
+        Callback done = std::move(f.done);
+        inflight_.pop_front();
+        done(true);
+    }
+}
+
+// Fails everything waiting on the connection and drops the socket; the
+// next submit() tries to reconnect.
+void AsyncDatabase::fail(const char* what) {
+    std::cerr << "Async DB: " << what << ": " << PQerrorMessage(db_.native_handle()) << "\n";
+    if (fd_ >= 0 && events_ != 0) loop_->unwatch(fd_);
+    fd_ = -1;
+    events_ = 0;
+    want_write_ = false;
+    state_ = State::Broken;
+
+    std::deque<InFlight> failed;
+    failed.swap(inflight_);
+    for (auto& f : waiting_) failed.push_back(std::move(f));
+    waiting_.clear();
+    for (auto& f : failed) f.done(false);
+}
+
+// At most once per interval while the database is down. Nothing here
+// blocks: the handshake and the preparations continue in on_ready().
+void AsyncDatabase::start_reconnect() {
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_reconnect_ < kReconnectInterval) return;
+    last_reconnect_ = now;
+
+    if (!db_.start_reset()) {
+        std::cerr << "Async DB: reconnect failed: " << PQerrorMessage(db_.native_handle()) << "\n";
+        return;
+    }
+    state_ = State::Connecting;
+    // libpq wants to be polled once the socket is writable
+    rearm(EPOLLOUT);
+}
+
+void AsyncDatabase::poll_reconnect() {
+    switch (db_.poll_reset()) {
+    case PGRES_POLLING_READING:
+        rearm(EPOLLIN);
+        return;
+    case PGRES_POLLING_WRITING:
+        rearm(EPOLLOUT);
+        return;
+    case PGRES_POLLING_OK:
+        break;
+    default:
+        fail("reconnect failed");
+        return;
+    }
+
+    // a new session has none of the prepared statements
+    PGconn* conn = db_.native_handle();
+    if (!enter_async_mode() || !db_.send_prepares() || !PQpipelineSync(conn)) {
+        fail("reconnect failed");
+        return;
+    }
+    state_ = State::Preparing;
+    want_write_ = false;
+    rearm(EPOLLIN);
+    flush();
+}
+
+// The preparations come back as one result each, then the sync; after
+// that the statements held back in waiting_ go out.
+void AsyncDatabase::read_prepares() {
+    PGconn* conn = db_.native_handle();
+    int nulls = 0;
+    while (!PQisBusy(conn)) {
+        PGresult* res = PQgetResult(conn);
+        if (!res) {
+            if (++nulls > 1) break;
+            continue;
+        }
+        nulls = 0;
+        ExecStatusType st = PQresultStatus(res);
+        PQclear(res);
+        if (st == PGRES_COMMAND_OK) continue;
+        if (st != PGRES_PIPELINE_SYNC) {
+            fail("prepare failed");
+            return;
+        }
+
+        state_ = State::Ready;
+        std::deque<InFlight> waiting;
+        waiting.swap(waiting_);
+        for (size_t i = 0; i < waiting.size(); ++i) {
+            if (send(waiting[i].op, waiting[i].done)) continue;
+            for (size_t j = i + 1; j < waiting.size(); ++j) waiting[j].done(false);
+            return;
+        }
+        flush();
+        return;
+    }
+}
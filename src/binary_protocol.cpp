@@ -0,0 +1,75 @@
+#include "binary_protocol.h"
+#include <cstring>
+
+namespace binproto {
+
+namespace {
+
+uint16_t read_u16(const char* p) {
+    const auto* b = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<uint16_t>(b[0] << 8 | b[1]);
+}
+
+uint32_t read_u32(const char* p) {
+    const auto* b = reinterpret_cast<const unsigned char*>(p);
+    return uint32_t(b[0]) << 24 | uint32_t(b[1]) << 16 | uint32_t(b[2]) << 8 | b[3];
+}
+
+bool has_nul(const char* p, size_t n) {
+    return std::memchr(p, '\0', n) != nullptr;
+}
+
+} // namespace
+
+ParseStatus parse(const char* data, size_t len, Frame& frame) {
+    if (len < kRequestHeader) return ParseStatus::Incomplete;
+    uint8_t op = static_cast<uint8_t>(data[0]);
+    size_t key_len = read_u16(data + 1);
+    size_t body_len = read_u32(data + 3);
+    if (op < uint8_t(Op::Get) || op > uint8_t(Op::MGet) || key_len > kMaxKeyBytes ||
+        body_len > kMaxBodyBytes)
+        return ParseStatus::Error;
+
+    frame.size = kRequestHeader + key_len + body_len;
+    if (len < frame.size) return ParseStatus::Incomplete;
+    if (has_nul(data + kRequestHeader, key_len)) return ParseStatus::Error;
+    frame.op = static_cast<Op>(op);
+    frame.key = {data + kRequestHeader, key_len};
+    frame.body = {data + kRequestHeader + key_len, body_len};
+    return ParseStatus::Done;
+}
+
+std::string_view method(Op op) {
+    switch (op) {
+    case Op::Get: return "GET";
+    case Op::Set: return "PUT";
+    case Op::Del: return "DELETE";
+    case Op::MGet: return "MGET";
+    }
+    return {};
+}
+
+bool parse_keys(std::string_view body, std::vector<std::string>& keys) {
+    while (!body.empty()) {
+        if (body.size() < 2) return false;
+        size_t n = read_u16(body.data());
+        if (n == 0 || n > kMaxKeyBytes || body.size() < 2 + n || has_nul(body.data() + 2, n))
+            return false;
+        keys.emplace_back(body.substr(2, n));
+        body.remove_prefix(2 + n);
+    }
+    return !keys.empty();
+}
+
+std::string response_head(uint8_t status, size_t body_len) {
+    std::string out(1, static_cast<char>(status));
+    append_u32(out, static_cast<uint32_t>(body_len));
+    return out;
+}
+
+void append_u32(std::string& out, uint32_t v) {
+    char b[4] = {char(v >> 24), char(v >> 16), char(v >> 8), char(v)};
+    out.append(b, 4);
+}
+
+} // namespace binproto
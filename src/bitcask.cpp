@@ -0,0 +1,662 @@
+#include "bitcask.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <array>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+namespace {
+
+constexpr uint32_t kTombstone = 0xffffffff;
+constexpr size_t kHeader = 12;
+// live records a compaction copies per append
+constexpr size_t kCompactChunkBytes = 4 << 20;
+
+// CRC-32C (Castagnoli), the polynomial SSE4.2 has an instruction for.
+uint32_t crc32c(const char* p, size_t n) {
+    uint32_t crc = 0xffffffff;
+#ifdef __SSE4_2__
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        crc = static_cast<uint32_t>(_mm_crc32_u64(crc, v));
+    }
+    for (; n; ++p, --n) crc = _mm_crc32_u8(crc, static_cast<uint8_t>(*p));
+#else
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    for (; n; ++p, --n) crc = table[(crc ^ static_cast<uint8_t>(*p)) & 0xff] ^ (crc >> 8);
+#endif
+    return ~crc;
+}
+
+// Appends one record to out; returns its size.
+uint32_t encode(std::string& out, const std::string& key, const std::string* value) {
+    uint32_t klen = static_cast<uint32_t>(key.size());
+    uint32_t vlen = value ? static_cast<uint32_t>(value->size()) : kTombstone;
+    size_t start = out.size();
+    out.resize(start + kHeader);
+    std::memcpy(&out[start + 4], &klen, 4);
+    std::memcpy(&out[start + 8], &vlen, 4);
+    out += key;
+    if (value) out += *value;
+    uint32_t crc = crc32c(out.data() + start + 4, out.size() - start - 4);
+    std::memcpy(&out[start], &crc, 4);
+    return static_cast<uint32_t>(out.size() - start);
+}
+
+// The record at off in buf, if it is whole and its CRC matches.
+struct Record {
+    uint32_t size;
+    uint32_t value_len;
+    std::string_view key;
+    std::string_view value;
+};
+
+bool decode(const std::string& buf, uint64_t off, Record& r) {
+    if (off + kHeader > buf.size()) return false;
+    uint32_t crc, klen;
+    std::memcpy(&crc, &buf[off], 4);
+    std::memcpy(&klen, &buf[off + 4], 4);
+    std::memcpy(&r.value_len, &buf[off + 8], 4);
+    uint64_t vbytes = r.value_len == kTombstone ? 0 : r.value_len;
+    uint64_t size = kHeader + uint64_t(klen) + vbytes;
+    if (off + size > buf.size() || crc32c(&buf[off + 4], size - 4) != crc) return false;
+    r.size = static_cast<uint32_t>(size);
+    r.key = std::string_view(&buf[off + kHeader], klen);
+    r.value = std::string_view(&buf[off + kHeader + klen], vbytes);
+    return true;
+}
+
+bool read_full(int fd, char* dst, size_t n, uint64_t off) {
+    while (n) {
+        ssize_t r = pread(fd, dst, n, static_cast<off_t>(off));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        dst += r;
+        off += static_cast<uint64_t>(r);
+        n -= static_cast<size_t>(r);
+    }
+    return true;
+}
+
+bool write_full(int fd, const char* src, size_t n, uint64_t off) {
+    while (n) {
+        ssize_t w = pwrite(fd, src, n, static_cast<off_t>(off));
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        src += w;
+        off += static_cast<uint64_t>(w);
+        n -= static_cast<size_t>(w);
+    }
+    return true;
+}
+
+// "00000042.data" -> 42; 0 for anything else
+uint32_t segment_id(const char* name) {
+    unsigned id = 0;
+    int len = 0;
+    if (std::sscanf(name, "%8u.data%n", &id, &len) != 1 || name[len] != '\0') return 0;
+    return id;
+}
+
+uint64_t elapsed_us(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+// ---------------------------- Bitcask ----------------------------
+
+Bitcask::Segment::~Segment() {
+    if (fd >= 0) ::close(fd);
+}
+
+Bitcask::Bitcask(const Options& options) : opts_(options) {
+    if (!recover()) return;
+    open_ = true;
+    if (opts_.sync == Sync::Interval) syncer_ = std::thread(&Bitcask::syncer_loop, this);
+    compactor_ = std::thread(&Bitcask::compactor_loop, this);
+}
+
+Bitcask::~Bitcask() {
+    close();
+}
+
+bool Bitcask::recover() {
+    if (mkdir(opts_.dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        std::cerr << "Bitcask: cannot create " << opts_.dir << ": " << std::strerror(errno) << "\n";
+        return false;
+    }
+    DIR* d = opendir(opts_.dir.c_str());
+    if (!d) {
+        std::cerr << "Bitcask: cannot open " << opts_.dir << ": " << std::strerror(errno) << "\n";
+        return false;
+    }
+    std::vector<uint32_t> ids;
+    while (dirent* e = readdir(d)) {
+        if (uint32_t id = segment_id(e->d_name)) ids.push_back(id);
+    }
+    closedir(d);
+    std::sort(ids.begin(), ids.end());
+
+    for (uint32_t id : ids) {
+        auto seg = open_segment(id);
+        if (!seg) return false;
+        segments_[id] = seg;
+        if (!replay(*seg, id == ids.back())) return false;
+        active_ = seg;
+        next_id_ = id + 1;
+    }
+    if (!active_ || active_->size >= opts_.segment_bytes) return roll_locked();
+    return true;
+}
+
+// Rebuilds the index from one segment. Whatever follows a bad record is
+// unreadable: cut off in the newest segment, counted dead in older ones.
+bool Bitcask::replay(Segment& seg, bool newest) {
+    std::string buf(seg.size, '\0');
+    if (!read_full(seg.fd, buf.data(), buf.size(), 0)) {
+        std::cerr << "Bitcask: cannot read " << seg.path << "\n";
+        return false;
+    }
+
+    uint64_t off = 0;
+    Record r;
+    while (decode(buf, off, r)) {
+        apply_locked(std::string(r.key), {seg.id, r.size, off, r.value_len}, r.value_len == kTombstone);
+        off += r.size;
+    }
+    if (off == buf.size()) return true;
+
+    corrupt_.fetch_add(1, std::memory_order_relaxed);
+    if (newest) {
+        std::cerr << "Bitcask: " << seg.path << ": dropping " << buf.size() - off
+                  << " bytes of torn or corrupt tail\n";
+        if (ftruncate(seg.fd, static_cast<off_t>(off)) < 0) return false;
+        seg.size = off;
+    } else {
+        std::cerr << "Bitcask: " << seg.path << ": corrupt record at " << off
+                  << ", ignoring the rest of the segment\n";
+        seg.dead += buf.size() - off;
+    }
+    return true;
+}
+
+std::shared_ptr<Bitcask::Segment> Bitcask::open_segment(uint32_t id) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%08u.data", id);
+    std::string path = opts_.dir + name;
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Bitcask: cannot open " << path << ": " << std::strerror(errno) << "\n";
+        return nullptr;
+    }
+    auto seg = std::make_shared<Segment>(id, fd, path);
+    struct stat st;
+    if (fstat(fd, &st) == 0) seg->size = static_cast<uint64_t>(st.st_size);
+    return seg;
+}
+
+// Starts a new active segment; the old one is synced first, as it will
+// not be synced again. Called with write_mtx_ held (or from the
+// constructor).
+bool Bitcask::roll_locked() {
+    if (active_ && opts_.sync != Sync::Never && fdatasync(active_->fd) == 0)
+        syncs_.fetch_add(1, std::memory_order_relaxed);
+    auto seg = open_segment(next_id_);
+    if (!seg) return false;
+    {
+        std::unique_lock<std::shared_mutex> lock(index_mtx_);
+        segments_[seg->id] = seg;
+    }
+    active_ = std::move(seg);
+    next_id_++;
+    return true;
+}
+
+// Writes the records with one pwrite at the end of the active segment and
+// then points the index at them. Every index change happens here, under
+// write_mtx_, so the order of records in the log is the order in which
+// they took effect, which is what recovery replays.
+bool Bitcask::append(const std::vector<Pending>& records) {
+    std::lock_guard<std::mutex> lock(write_mtx_);
+
+    std::vector<const Pending*> todo;
+    std::vector<uint64_t> starts;
+    std::vector<uint32_t> sizes;
+    std::string buf;
+    for (const Pending& p : records) {
+        if (p.check) {
+            auto it = index_.find(*p.key);
+            bool current = p.value ? (it != index_.end() && it->second == p.expect) : it == index_.end();
+            if (!current) continue;   // rewritten or deleted since the compactor looked
+        }
+        todo.push_back(&p);
+        starts.push_back(buf.size());
+        sizes.push_back(encode(buf, *p.key, p.value));
+    }
+    if (todo.empty()) return true;
+
+    if (active_->size > 0 && active_->size + buf.size() > opts_.segment_bytes && !roll_locked())
+        return false;
+    uint64_t base = active_->size;
+    if (!write_full(active_->fd, buf.data(), buf.size(), base)) {
+        std::cerr << "Bitcask: write to " << active_->path << " failed: " << std::strerror(errno) << "\n";
+        return false;
+    }
+    if (opts_.sync == Sync::Always) {
+        if (fdatasync(active_->fd) < 0) return false;
+        syncs_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        dirty_.store(true, std::memory_order_relaxed);
+    }
+
+    std::unique_lock<std::shared_mutex> index_lock(index_mtx_);
+    for (size_t i = 0; i < todo.size(); ++i) {
+        const Pending& p = *todo[i];
+        uint32_t value_len = p.value ? static_cast<uint32_t>(p.value->size()) : kTombstone;
+        apply_locked(*p.key, {active_->id, sizes[i], base + starts[i], value_len}, !p.value);
+    }
+    active_->size = base + buf.size();
+    return true;
+}
+
+// The record at loc is now the latest for key: whatever the index had
+// before is dead, and so is a tombstone itself.
+void Bitcask::apply_locked(const std::string& key, const Location& loc, bool tombstone) {
+    auto it = index_.find(key);
+    if (it != index_.end()) segments_[it->second.segment]->dead += it->second.size;
+    if (tombstone) {
+        if (it != index_.end()) {
+            ordered_.erase(it->first);
+            index_.erase(it);
+        }
+        segments_[loc.segment]->dead += loc.size;
+    } else if (it != index_.end()) {
+        it->second = loc;
+    } else {
+        ordered_.insert(index_.emplace(key, loc).first->first);
+    }
+}
+
+bool Bitcask::put(const std::string& key, const std::string& value) {
+    return append({{&key, &value}});
+}
+
+bool Bitcask::remove(const std::string& key) {
+    return append({{&key, nullptr}});
+}
+
+bool Bitcask::write_batch(const std::vector<Storage::KeyValue>& upserts,
+                          const std::vector<const std::string*>& deletes) {
+    std::vector<Pending> records;
+    records.reserve(upserts.size() + deletes.size());
+    for (const auto& kv : upserts) records.push_back({kv.first, kv.second});
+    for (const std::string* key : deletes) records.push_back({key, nullptr});
+    return append(records);
+}
+
+// The segment is held by shared_ptr, so a compaction that deletes it
+// meanwhile only unlinks the file; this read still sees the old record.
+bool Bitcask::get(const std::string& key, std::optional<std::string>& value) {
+    value.reset();
+    Location loc;
+    std::shared_ptr<Segment> seg;
+    {
+        std::shared_lock<std::shared_mutex> lock(index_mtx_);
+        auto it = index_.find(key);
+        if (it == index_.end()) return true;
+        loc = it->second;
+        seg = segments_.at(loc.segment);
+    }
+
+    std::string rec(loc.size, '\0');
+    if (!read_full(seg->fd, rec.data(), rec.size(), loc.offset)) {
+        std::cerr << "Bitcask: " << seg->path << ": read failed at " << loc.offset << "\n";
+        return false;
+    }
+    uint32_t crc;
+    std::memcpy(&crc, rec.data(), 4);
+    if (crc32c(rec.data() + 4, rec.size() - 4) != crc) {
+        corrupt_.fetch_add(1, std::memory_order_relaxed);
+        std::cerr << "Bitcask: " << seg->path << ": bad CRC at " << loc.offset << "\n";
+        return false;
+    }
+    rec.erase(0, loc.size - loc.value_len);
+    value = std::move(rec);
+    return true;
+}
+
+std::vector<std::string> Bitcask::keys(const std::string& prefix, const std::string& start,
+                                       size_t limit) const {
+    std::vector<std::string> out;
+    std::shared_lock<std::shared_mutex> lock(index_mtx_);
+    for (auto it = ordered_.lower_bound(std::max(prefix, start)); it != ordered_.end(); ++it) {
+        if (limit && out.size() == limit) break;
+        if (it->compare(0, prefix.size(), prefix) != 0) break;   // past the prefix range
+        out.emplace_back(*it);
+    }
+    return out;
+}
+
+std::vector<std::string> Bitcask::partition_keys(const std::string& prefix, uint32_t part, uint32_t parts,
+                                                 size_t limit) const {
+    std::vector<std::string> out;
+    std::shared_lock<std::shared_mutex> lock(index_mtx_);
+    size_t buckets = index_.bucket_count();
+    size_t last = buckets * (part + 1) / parts;
+    for (size_t b = buckets * part / parts; b < last; ++b) {
+        for (auto it = index_.begin(b); it != index_.end(b); ++it) {
+            if (limit && out.size() == limit) return out;
+            if (it->first.compare(0, prefix.size(), prefix) == 0) out.push_back(it->first);
+        }
+    }
+    return out;
+}
+
+void Bitcask::sync() {
+    if (!dirty_.exchange(false)) return;
+    std::shared_ptr<Segment> seg;
+    {
+        std::lock_guard<std::mutex> lock(write_mtx_);
+        seg = active_;
+    }
+    if (seg && fdatasync(seg->fd) == 0) syncs_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool Bitcask::load_epoch(std::string& token) const {
+    token.clear();
+    std::string path = opts_.dir + "/EPOCH";
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return errno == ENOENT;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    if (ok) {
+        token.resize(static_cast<size_t>(st.st_size));
+        ok = read_full(fd, token.data(), token.size(), 0);
+    }
+    ::close(fd);
+    if (!ok) std::cerr << "Bitcask: cannot read " << path << ": " << std::strerror(errno) << "\n";
+    return ok;
+}
+
+// Replaced whole: written to a temp file, synced, renamed over the old one.
+bool Bitcask::store_epoch(const std::string& token) {
+    sync();
+    std::string path = opts_.dir + "/EPOCH";
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0 && write_full(fd, token.data(), token.size(), 0) && fdatasync(fd) == 0;
+    if (fd >= 0) ::close(fd);
+    ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        std::cerr << "Bitcask: cannot write " << path << ": " << std::strerror(errno) << "\n";
+        unlink(tmp.c_str());
+    }
+    return ok;
+}
+
+void Bitcask::close() {
+    {
+        std::lock_guard<std::mutex> lock(bg_mtx_);
+        stopping_ = true;
+    }
+    bg_cv_.notify_all();
+    if (syncer_.joinable()) syncer_.join();
+    if (compactor_.joinable()) compactor_.join();
+    if (open_) sync();
+}
+
+Bitcask::Stats Bitcask::stats() const {
+    Stats s;
+    s.syncs = syncs_.load(std::memory_order_relaxed);
+    s.compactions = compactions_.load(std::memory_order_relaxed);
+    s.reclaimed_bytes = reclaimed_.load(std::memory_order_relaxed);
+    s.corrupt_records = corrupt_.load(std::memory_order_relaxed);
+
+    std::shared_lock<std::shared_mutex> lock(index_mtx_);
+    s.keys = index_.size();
+    s.segments = segments_.size();
+    for (const auto& kv : segments_) {
+        s.disk_bytes += kv.second->size;
+        s.dead_bytes += kv.second->dead;
+    }
+    return s;
+}
+
+void Bitcask::syncer_loop() {
+    std::unique_lock<std::mutex> lock(bg_mtx_);
+    while (!bg_cv_.wait_for(lock, opts_.sync_interval, [&] { return stopping_; })) {
+        lock.unlock();
+        sync();
+        lock.lock();
+    }
+}
+
+// Every compact_interval, rewrites the closed segments that have reached
+// compact_ratio dead, oldest first.
+void Bitcask::compactor_loop() {
+    std::unique_lock<std::mutex> lock(bg_mtx_);
+    while (!bg_cv_.wait_for(lock, opts_.compact_interval, [&] { return stopping_; })) {
+        lock.unlock();
+
+        uint32_t active_id;
+        {
+            std::lock_guard<std::mutex> write_lock(write_mtx_);
+            active_id = active_->id;
+        }
+        std::vector<std::shared_ptr<Segment>> victims;
+        {
+            std::shared_lock<std::shared_mutex> index_lock(index_mtx_);
+            for (const auto& kv : segments_) {
+                const Segment& seg = *kv.second;
+                if (seg.id < active_id && seg.size > 0 && seg.dead >= opts_.compact_ratio * seg.size)
+                    victims.push_back(kv.second);
+            }
+        }
+        std::sort(victims.begin(), victims.end(),
+                  [](const auto& a, const auto& b) { return a->id < b->id; });
+        for (const auto& seg : victims) compact(seg);
+
+        lock.lock();
+    }
+}
+
+// Copies the segment's live records to the active segment, syncs them,
+// then drops the segment. A tombstone is copied too while an older
+// segment might still hold a value it hides; append() re-checks each copy
+// against writes that raced with the copy.
+void Bitcask::compact(const std::shared_ptr<Segment>& seg) {
+    std::string buf(seg->size, '\0');
+    if (!read_full(seg->fd, buf.data(), buf.size(), 0)) return;
+
+    bool older_exists = false;
+    {
+        std::shared_lock<std::shared_mutex> lock(index_mtx_);
+        for (const auto& kv : segments_) older_exists |= kv.first < seg->id;
+    }
+
+    std::vector<std::string> keys, values;
+    std::vector<Location> where;
+    size_t pending_bytes = 0;
+    auto flush = [&] {
+        std::vector<Pending> records;
+        records.reserve(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            bool tombstone = where[i].value_len == kTombstone;
+            records.push_back({&keys[i], tombstone ? nullptr : &values[i], true, where[i]});
+        }
+        bool ok = append(records);
+        keys.clear();
+        values.clear();
+        where.clear();
+        pending_bytes = 0;
+        return ok;
+    };
+
+    uint64_t off = 0;
+    Record r;
+    while (decode(buf, off, r)) {
+        Location here{seg->id, r.size, off, r.value_len};
+        bool tombstone = r.value_len == kTombstone;
+        bool live;
+        {
+            std::shared_lock<std::shared_mutex> lock(index_mtx_);
+            auto it = index_.find(std::string(r.key));
+            live = tombstone ? (it == index_.end() && older_exists) : (it != index_.end() && it->second == here);
+        }
+        if (live) {
+            keys.emplace_back(r.key);
+            values.emplace_back(r.value);
+            where.push_back(here);
+            pending_bytes += r.size;
+            if (pending_bytes >= kCompactChunkBytes && !flush()) return;
+        }
+        off += r.size;
+    }
+    if (!keys.empty() && !flush()) return;
+
+    // the copies must be on disk before the originals go
+    {
+        std::shared_ptr<Segment> active;
+        {
+            std::lock_guard<std::mutex> lock(write_mtx_);
+            active = active_;
+        }
+        if (fdatasync(active->fd) < 0) return;
+        syncs_.fetch_add(1, std::memory_order_relaxed);
+    }
+    {
+        std::unique_lock<std::shared_mutex> lock(index_mtx_);
+        segments_.erase(seg->id);
+    }
+    unlink(seg->path.c_str());
+    compactions_.fetch_add(1, std::memory_order_relaxed);
+    reclaimed_.fetch_add(seg->size, std::memory_order_relaxed);
+}
+
+// ---------------------------- BitcaskStore ----------------------------
+
+bool BitcaskStore::put(const std::string& key, const std::string& value) {
+    auto start = std::chrono::steady_clock::now();
+    bool ok = db_.put(key, value);
+    put_timer_.record(elapsed_us(start));
+    return ok;
+}
+
+bool BitcaskStore::get(const std::string& key, std::optional<std::string>& value) {
+    auto start = std::chrono::steady_clock::now();
+    bool ok = db_.get(key, value);
+    get_timer_.record(elapsed_us(start));
+    return ok;
+}
+
+bool BitcaskStore::remove(const std::string& key) {
+    auto start = std::chrono::steady_clock::now();
+    bool ok = db_.remove(key);
+    remove_timer_.record(elapsed_us(start));
+    return ok;
+}
+
+bool BitcaskStore::get_many(const std::vector<const std::string*>& keys,
+                            std::vector<std::optional<std::string>>& values) {
+    auto start = std::chrono::steady_clock::now();
+    values.clear();
+    values.resize(keys.size());
+    bool ok = true;
+    for (size_t i = 0; ok && i < keys.size(); ++i) ok = db_.get(*keys[i], values[i]);
+    get_timer_.record(elapsed_us(start));
+    return ok;
+}
+
+bool BitcaskStore::write_batch(const std::vector<KeyValue>& upserts,
+                               const std::vector<const std::string*>& deletes) {
+    auto start = std::chrono::steady_clock::now();
+    bool ok = db_.write_batch(upserts, deletes);
+    uint64_t us = elapsed_us(start);
+    if (!upserts.empty()) put_timer_.record(us);
+    if (!deletes.empty()) remove_timer_.record(us);
+    return ok;
+}
+
+bool BitcaskStore::scan_open(const std::string& prefix, const std::string& start, size_t limit) {
+    scan_prefix_ = prefix;
+    scan_next_ = std::max(prefix, start);
+    scan_left_ = limit ? limit : SIZE_MAX;
+    return true;
+}
+
+bool BitcaskStore::scan_fetch(size_t n, std::vector<Row>& rows) {
+    rows.clear();
+    auto start = std::chrono::steady_clock::now();
+    bool ok = true;
+    std::optional<std::string> value;
+    // keys deleted since they were listed are skipped, so ask again until
+    // the chunk is full or the keys run out
+    while (ok && rows.size() < n && scan_left_ > 0) {
+        std::vector<std::string> keys = db_.keys(scan_prefix_, scan_next_, std::min(n - rows.size(), scan_left_));
+        if (keys.empty()) {
+            scan_left_ = 0;
+            break;
+        }
+        scan_next_ = keys.back() + '\0';   // the smallest key after it
+        for (std::string& key : keys) {
+            if (!(ok = db_.get(key, value))) break;
+            if (!value) continue;
+            rows.emplace_back(std::move(key), std::move(*value));
+            scan_left_--;
+        }
+    }
+    scan_timer_.record(elapsed_us(start));
+    return ok;
+}
+
+void BitcaskStore::scan_close() {
+    scan_prefix_.clear();
+    scan_next_.clear();
+    scan_left_ = 0;
+}
+
+bool BitcaskStore::dump(const DumpFilter& filter, const RowSink& sink) {
+    std::vector<std::string> keys =
+        filter.keys ? std::vector<std::string>(filter.keys, filter.keys + filter.num_keys)
+                    : db_.partition_keys(filter.prefix, filter.part, filter.parts, filter.limit);
+    size_t rows = 0;
+    bool ok = true;
+    std::optional<std::string> value;
+    for (std::string& key : keys) {
+        if (filter.limit && rows == filter.limit) break;
+        if (key.compare(0, filter.prefix.size(), filter.prefix) != 0) continue;
+        if (!(ok = db_.get(key, value))) break;
+        if (!value) continue;
+        sink(std::move(key), std::move(*value));
+        rows++;
+    }
+    return ok;
+}
+
+DBStats BitcaskStore::stats() const {
+    DBStats s;
+    s.put = put_timer_.load();
+    s.get = get_timer_.load();
+    s.remove = remove_timer_.load();
+    s.scan = scan_timer_.load();
+    return s;
+}
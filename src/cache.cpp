@@ -1,52 +1,315 @@
 #include "cache.h"
+#include <algorithm>
+#include <functional>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-LRUCache::LRUCache(size_t capacity) : max_capacity_(capacity) {}
+namespace {
 
-std::optional<std::string> LRUCache::get(const std::string& key) {
+constexpr int8_t kEmpty = -128;
+constexpr int8_t kDeleted = -2;
+constexpr size_t kGroupWidth = 16;
+
+inline int8_t h2_of(uint64_t hash) { return static_cast<int8_t>(hash & 0x7F); }
+inline size_t h1_of(uint64_t hash) { return static_cast<size_t>(hash >> 7); }
+
+// Bitmasks over one 16-slot metadata group.
+#ifdef __SSE2__
+inline uint32_t match_byte(const int8_t* group, int8_t b) {
+    __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b))));
+}
+inline uint32_t match_free(const int8_t* group) {
+    // empty and deleted are the only bytes with the sign bit set
+    __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+}
+#else
+inline uint32_t match_byte(const int8_t* group, int8_t b) {
+    uint32_t mask = 0;
+    for (size_t i = 0; i < kGroupWidth; ++i) if (group[i] == b) mask |= 1u << i;
+    return mask;
+}
+inline uint32_t match_free(const int8_t* group) {
+    uint32_t mask = 0;
+    for (size_t i = 0; i < kGroupWidth; ++i) if (group[i] < 0) mask |= 1u << i;
+    return mask;
+}
+#endif
+
+inline uint64_t hash_of(const std::string& key) { return std::hash<std::string>{}(key); }
+
+} // namespace
+
+LRUCache::LRUCache(size_t capacity, bool tinylfu) : max_capacity_(capacity) {
+    // a window and a main segment need at least one entry each
+    if (tinylfu && capacity >= 2) {
+        window_capacity_ = std::max<size_t>(1, capacity / 100);
+        sketch_ = std::make_unique<FrequencySketch>(capacity);
+    }
+    rehash(kGroupWidth);
+}
+
+CacheValue LRUCache::get(const std::string& key) {
+    uint64_t h = hash_of(key);
     std::lock_guard<std::mutex> lock(mutex_);
+    if (sketch_) sketch_->increment(h);
     
-    auto it = index_.find(key);
-    if (it == index_.end()) {
-        return std::nullopt;
+    size_t i = find(key, h);
+    if (i == SIZE_MAX) {
+        stats_.misses++;
+        return nullptr;
     }
     
-    items_.splice(items_.begin(), items_, it->second);
-    return it->second->second;
+    stats_.hits++;
+    touch(static_cast<uint32_t>(i));
+    return slots_[i].value;
 }
 
 
 
-void LRUCache::put(const std::string& key, const std::string& value) {
+void LRUCache::put(const std::string& key, CacheValue value) {
+    uint64_t h = hash_of(key);
     std::lock_guard<std::mutex> lock(mutex_);
+    if (sketch_) sketch_->increment(h);
     
-    auto it = index_.find(key);
-    if (it != index_.end()) {
-        it->second->second = value;
-        items_.splice(items_.begin(), items_, it->second);
+    size_t i = find(key, h);
+    if (i != SIZE_MAX) {
+        slots_[i].value = std::move(value);
+        touch(static_cast<uint32_t>(i));
+        return;
+    }
+
+    if (sketch_) {
+        put_admitted(key, std::move(value), h);
         return;
     }
     
-    if (items_.size() >= max_capacity_) {
-        auto last_key = items_.rbegin()->first;
-        items_.pop_back();
-        index_.erase(last_key);
+    if (count_ >= max_capacity_ && items_.tail != kNil) {
+        erase(items_.tail);
+        stats_.evictions++;
     }
 
-    items_.emplace_front(key, value);
-    index_[key] = items_.begin();
+    link_front(items_, insert(key, std::move(value), h));
+}
+
+// New key under W-TinyLFU: always enters the window; whatever falls out of
+// the window then has to beat the main LRU's tail on estimated frequency.
+void LRUCache::put_admitted(const std::string& key, CacheValue value, uint64_t hash) {
+    uint32_t fresh = insert(key, std::move(value), hash);
+    slots_[fresh].in_window = true;
+    link_front(window_, fresh);
+    if (window_.size <= window_capacity_) return;
+
+    uint32_t candidate = window_.tail;
+    if (items_.size < max_capacity_ - window_capacity_) {
+        unlink(window_, candidate);
+        slots_[candidate].in_window = false;
+        link_front(items_, candidate);
+        stats_.admitted++;
+        return;
+    }
+
+    uint32_t victim = items_.tail;
+    uint32_t candidate_freq = sketch_->estimate(hash_of(slots_[candidate].key));
+    uint32_t victim_freq = sketch_->estimate(hash_of(slots_[victim].key));
+    stats_.evictions++;
+
+    if (candidate_freq > victim_freq) {
+        erase(victim);
+        unlink(window_, candidate);
+        slots_[candidate].in_window = false;
+        link_front(items_, candidate);
+        stats_.admitted++;
+    } else {
+        erase(candidate);
+        stats_.rejected++;
+    }
 }
 
 void LRUCache::remove(const std::string& key) {
+    uint64_t h = hash_of(key);
     std::lock_guard<std::mutex> lock(mutex_);
     
-    auto it = index_.find(key);
-    if (it != index_.end()) {
-        items_.erase(it->second);
-        index_.erase(it);
+    size_t i = find(key, h);
+    if (i != SIZE_MAX) {
+        erase(static_cast<uint32_t>(i));
     }
 }
 
 size_t LRUCache::size() const {
     std::lock_guard<std::mutex> lock(mutex_);
-    return index_.size();
+    return count_;
+}
+
+CacheStats LRUCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CacheStats s = stats_;
+    s.entries = count_;
+    return s;
+}
+
+void LRUCache::entries(std::vector<Cache::Entry>& out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const RecencyList* l : {&items_, &window_}) {
+        for (uint32_t i = l->tail; i != kNil; i = slots_[i].prev)
+            out.emplace_back(slots_[i].key, slots_[i].value);
+    }
+}
+
+// Triangular probing over 16-wide groups; visits every group once because
+// the group count is a power of two.
+size_t LRUCache::find(const std::string& key, uint64_t hash) const {
+    size_t group_mask = ctrl_.size() / kGroupWidth - 1;
+    size_t g = h1_of(hash) & group_mask;
+    int8_t h2 = h2_of(hash);
+
+    for (size_t step = 0; step <= group_mask; ++step) {
+        const int8_t* group = &ctrl_[g * kGroupWidth];
+        for (uint32_t m = match_byte(group, h2); m; m &= m - 1) {
+            size_t i = g * kGroupWidth + __builtin_ctz(m);
+            if (slots_[i].key == key) return i;
+        }
+        if (match_byte(group, kEmpty)) return SIZE_MAX;
+        g = (g + step + 1) & group_mask;
+    }
+    return SIZE_MAX;
+}
+
+// Places a key known to be absent; the caller links it into a list.
+uint32_t LRUCache::insert(std::string key, CacheValue value, uint64_t hash) {
+    if (growth_left_ == 0) {
+        // grow when live entries fill the table, otherwise just drop tombstones
+        size_t slots = ctrl_.size();
+        rehash((count_ + 1) * 16 > slots * 7 ? slots * 2 : slots);
+    }
+
+    size_t group_mask = ctrl_.size() / kGroupWidth - 1;
+    size_t g = h1_of(hash) & group_mask;
+    for (size_t step = 0;; ++step) {
+        uint32_t m = match_free(&ctrl_[g * kGroupWidth]);
+        if (m) {
+            uint32_t i = static_cast<uint32_t>(g * kGroupWidth + __builtin_ctz(m));
+            if (ctrl_[i] == kEmpty) growth_left_--;
+            ctrl_[i] = h2_of(hash);
+            slots_[i].key = std::move(key);
+            slots_[i].value = std::move(value);
+            count_++;
+            return i;
+        }
+        g = (g + step + 1) & group_mask;
+    }
+}
+
+void LRUCache::erase(uint32_t i) {
+    unlink(list_of(i), i);
+    // a group that still has an empty byte never made a probe continue
+    // past it, so the slot can go straight back to empty
+    size_t g = i / kGroupWidth;
+    if (match_byte(&ctrl_[g * kGroupWidth], kEmpty)) {
+        ctrl_[i] = kEmpty;
+        growth_left_++;
+    } else {
+        ctrl_[i] = kDeleted;
+    }
+    slots_[i] = Slot{};
+    count_--;
+}
+
+// Rebuilds the table at new_slots, re-linking both lists in their current
+// recency order.
+void LRUCache::rehash(size_t new_slots) {
+    std::vector<Slot> old_slots;
+    old_slots.swap(slots_);
+    RecencyList old_lists[2] = {items_, window_};
+
+    ctrl_.assign(new_slots, kEmpty);
+    slots_.resize(new_slots);
+    growth_left_ = new_slots * 7 / 8;
+    count_ = 0;
+    items_ = RecencyList{};
+    window_ = RecencyList{};
+
+    for (int l = 0; l < 2; ++l) {
+        for (uint32_t i = old_lists[l].tail; i != kNil; i = old_slots[i].prev) {
+            Slot& old = old_slots[i];
+            uint64_t h = hash_of(old.key);
+            uint32_t j = insert(std::move(old.key), std::move(old.value), h);
+            slots_[j].in_window = old.in_window;
+            link_front(old.in_window ? window_ : items_, j);
+        }
+    }
+}
+
+void LRUCache::link_front(RecencyList& l, uint32_t i) {
+    slots_[i].prev = kNil;
+    slots_[i].next = l.head;
+    if (l.head != kNil) slots_[l.head].prev = i;
+    l.head = i;
+    if (l.tail == kNil) l.tail = i;
+    l.size++;
+}
+
+void LRUCache::unlink(RecencyList& l, uint32_t i) {
+    Slot& s = slots_[i];
+    if (s.prev != kNil) slots_[s.prev].next = s.next;
+    else l.head = s.next;
+    if (s.next != kNil) slots_[s.next].prev = s.prev;
+    else l.tail = s.prev;
+    s.prev = s.next = kNil;
+    l.size--;
+}
+
+void LRUCache::touch(uint32_t i) {
+    RecencyList& l = list_of(i);
+    if (l.head == i) return;
+    unlink(l, i);
+    link_front(l, i);
+}
+
+ShardedLRUCache::ShardedLRUCache(size_t capacity, size_t num_shards, bool tinylfu) {
+    // never more shards than entries, and every shard holds at least one
+    size_t n = std::max<size_t>(1, std::min(num_shards, std::max<size_t>(1, capacity)));
+    shards_.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        size_t share = capacity / n + (i < capacity % n ? 1 : 0);
+        shards_.push_back(std::make_unique<LRUCache>(std::max<size_t>(1, share), tinylfu));
+    }
+}
+
+LRUCache& ShardedLRUCache::shard_for(const std::string& key) {
+    // high bits pick the shard; the low bits are the table's h2 tag, which
+    // would otherwise share its low bits across every key in a shard
+    uint64_t hash = std::hash<std::string>{}(key);
+    return *shards_[(hash >> 32) % shards_.size()];
+}
+
+CacheValue ShardedLRUCache::get(const std::string& key) {
+    return shard_for(key).get(key);
+}
+
+void ShardedLRUCache::put(const std::string& key, CacheValue value) {
+    shard_for(key).put(key, std::move(value));
+}
+
+void ShardedLRUCache::remove(const std::string& key) {
+    shard_for(key).remove(key);
+}
+
+size_t ShardedLRUCache::size() const {
+    size_t total = 0;
+    for (const auto& s : shards_) total += s->size();
+    return total;
+}
+
+CacheStats ShardedLRUCache::stats() const {
+    CacheStats total;
+    for (const auto& s : shards_) total += s->stats();
+    return total;
+}
+
+void ShardedLRUCache::entries(std::vector<Entry>& out) const {
+    out.reserve(out.size() + size());
+    for (const auto& s : shards_) s->entries(out);
 }
@@ -0,0 +1,165 @@
+#include "cache_snapshot.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string_view>
+
+namespace cache_snapshot {
+
+namespace {
+
+constexpr char kMagic[8] = {'K', 'V', 'S', 'N', 'A', 'P', '0', '1'};
+constexpr size_t kHeader = sizeof(kMagic) + 4 + 8;
+constexpr size_t kEntryHeader = 8;
+// buffered before each write(2)
+constexpr size_t kFlushBytes = 1 << 20;
+
+template <typename T>
+void append(std::string& out, T v) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+template <typename T>
+T read_at(const char* p) {
+    T v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+bool write_all(int fd, const std::string& buf) {
+    const char* p = buf.data();
+    size_t n = buf.size();
+    while (n) {
+        ssize_t w = ::write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w;
+        n -= static_cast<size_t>(w);
+    }
+    return true;
+}
+
+} // namespace
+
+std::string new_epoch() {
+    static const char kHex[] = "0123456789abcdef";
+    std::random_device rd;
+    std::string out;
+    for (int i = 0; i < 8; ++i) {
+        uint32_t r = rd();
+        for (int b = 0; b < 4; ++b, r >>= 8) {
+            out += kHex[(r >> 4) & 0xf];
+            out += kHex[r & 0xf];
+        }
+    }
+    return out;
+}
+
+bool write(const std::string& path, const std::string& epoch, const std::vector<Cache::Entry>& entries) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Snapshot: cannot create " << path << ": " << std::strerror(errno) << "\n";
+        return false;
+    }
+
+    std::string buf;
+    buf.reserve(kFlushBytes + kFlushBytes / 4);
+    buf.append(kMagic, sizeof(kMagic));
+    append(buf, static_cast<uint32_t>(epoch.size()));
+    append(buf, static_cast<uint64_t>(entries.size()));
+    buf += epoch;
+
+    bool ok = true;
+    for (const auto& e : entries) {
+        append(buf, static_cast<uint32_t>(e.first.size()));
+        append(buf, static_cast<uint32_t>(e.second->size()));
+        buf += e.first;
+        buf += *e.second;
+        if (buf.size() >= kFlushBytes) {
+            if (!(ok = write_all(fd, buf))) break;
+            buf.clear();
+        }
+    }
+    ok = ok && write_all(fd, buf) && fdatasync(fd) == 0;
+    if (!ok) std::cerr << "Snapshot: cannot write " << path << ": " << std::strerror(errno) << "\n";
+    ::close(fd);
+    return ok;
+}
+
+void remove(const std::string& path) {
+    if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+        std::cerr << "Snapshot: cannot remove " << path << ": " << std::strerror(errno) << "\n";
+        return;
+    }
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || fsync(fd) < 0)
+        std::cerr << "Snapshot: cannot sync " << dir << ": " << std::strerror(errno) << "\n";
+    if (fd >= 0) ::close(fd);
+}
+
+LoadResult load(const std::string& path, const std::string& epoch, Cache& cache) {
+    LoadResult result;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) std::cerr << "Snapshot: cannot open " << path << ": " << std::strerror(errno) << "\n";
+        return result;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < kHeader) {
+        ::close(fd);
+        result.status = LoadStatus::Corrupt;
+        return result;
+    }
+    result.bytes = static_cast<size_t>(st.st_size);
+    void* map = mmap(nullptr, result.bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        std::cerr << "Snapshot: cannot map " << path << ": " << std::strerror(errno) << "\n";
+        result.status = LoadStatus::Corrupt;
+        return result;
+    }
+    // read ahead the whole file; it is consumed front to back exactly once
+    madvise(map, result.bytes, MADV_WILLNEED);
+    madvise(map, result.bytes, MADV_SEQUENTIAL);
+
+    const char* p = static_cast<const char*>(map);
+    const char* end = p + result.bytes;
+    uint32_t epoch_len = read_at<uint32_t>(p + sizeof(kMagic));
+    uint64_t count = read_at<uint64_t>(p + sizeof(kMagic) + 4);
+    if (std::memcmp(p, kMagic, sizeof(kMagic)) != 0 || epoch_len > result.bytes - kHeader) {
+        result.status = LoadStatus::Corrupt;
+    } else if (epoch.empty() || std::string_view(p + kHeader, epoch_len) != epoch) {
+        result.status = LoadStatus::Stale;
+    } else {
+        result.status = LoadStatus::Loaded;
+        p += kHeader + epoch_len;
+        for (uint64_t i = 0; i < count; ++i) {
+            if (size_t(end - p) < kEntryHeader) {
+                result.status = LoadStatus::Corrupt;
+                break;
+            }
+            size_t key_len = read_at<uint32_t>(p);
+            size_t value_len = read_at<uint32_t>(p + 4);
+            if (size_t(end - p) - kEntryHeader < key_len + value_len) {
+                result.status = LoadStatus::Corrupt;
+                break;
+            }
+            p += kEntryHeader;
+            cache.put(std::string(p, key_len), std::make_shared<const std::string>(p + key_len, value_len));
+            p += key_len + value_len;
+            result.entries++;
+        }
+    }
+    munmap(map, result.bytes);
+    return result;
+}
+
+} // namespace cache_snapshot
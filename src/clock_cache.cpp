@@ -0,0 +1,209 @@
+#include "clock_cache.h"
+#include "epoch.h"
+#include <algorithm>
+#include <functional>
+
+ClockCache::Table::Table(size_t n) : mask(n - 1), slots(new std::atomic<Node*>[n]) {
+    for (size_t i = 0; i < n; ++i) slots[i].store(nullptr, std::memory_order_relaxed);
+}
+
+ClockCache::ClockCache(size_t capacity, size_t num_shards) {
+    size_t n = std::max<size_t>(1, std::min(num_shards, std::max<size_t>(1, capacity)));
+    shards_.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        auto s = std::make_unique<Shard>();
+        s->capacity = std::max<size_t>(1, capacity / n + (i < capacity % n ? 1 : 0));
+
+        // keep the load factor (live + tombstones) under 3/4 of 2x capacity
+        size_t slots = 8;
+        while (slots < s->capacity * 2) slots <<= 1;
+        s->table.store(new Table(slots));
+        shards_.push_back(std::move(s));
+    }
+}
+
+ClockCache::~ClockCache() {
+    for (auto& s : shards_) {
+        Table* t = s->table.load();
+        for (size_t i = 0; i <= t->mask; ++i) {
+            Node* n = t->slots[i].load();
+            if (n && n != tombstone()) delete n;
+        }
+        delete t;
+    }
+}
+
+ClockCache::Node* ClockCache::tombstone() {
+    static Node marker;
+    return &marker;
+}
+
+uint64_t ClockCache::hash_key(const std::string& key) {
+    return std::hash<std::string>{}(key);
+}
+
+ClockCache::Shard& ClockCache::shard_for(uint64_t hash) {
+    // high bits pick the shard, low bits the slot
+    return *shards_[(hash >> 32) % shards_.size()];
+}
+
+CacheValue ClockCache::get(const std::string& key) {
+    uint64_t h = hash_key(key);
+    Shard& s = shard_for(h);
+
+    EpochManager::Guard guard;
+    Table* t = s.table.load(std::memory_order_acquire);
+    size_t idx = h & t->mask;
+    for (size_t probes = 0; probes <= t->mask; ++probes) {
+        Node* n = t->slots[idx].load(std::memory_order_acquire);
+        if (!n) break;
+        if (n != tombstone() && n->hash == h && n->key == key) {
+            // only write when the bit is clear, so a hot key stays read-shared
+            if (!n->referenced.load(std::memory_order_relaxed))
+                n->referenced.store(true, std::memory_order_relaxed);
+            hits_.add();
+            return n->value;
+        }
+        idx = (idx + 1) & t->mask;
+    }
+    misses_.add();
+    return nullptr;
+}
+
+void ClockCache::put(const std::string& key, CacheValue value) {
+    uint64_t h = hash_key(key);
+    Shard& s = shard_for(h);
+    Node* fresh = new Node{h, key, std::move(value)};
+
+    std::lock_guard<std::mutex> lock(s.write_mutex);
+    Table* t = s.table.load(std::memory_order_relaxed);
+
+    size_t idx = find_slot(t, h, key);
+    if (idx != SIZE_MAX) {
+        fresh->referenced.store(true, std::memory_order_relaxed);
+        retire(t->slots[idx].exchange(fresh, std::memory_order_acq_rel));
+        return;
+    }
+
+    if (s.count.load(std::memory_order_relaxed) >= s.capacity) evict_one(s);
+    if ((s.count.load(std::memory_order_relaxed) + s.tombstones + 1) * 4 > (t->mask + 1) * 3) {
+        rebuild(s);
+        t = s.table.load(std::memory_order_relaxed);
+    }
+
+    idx = h & t->mask;
+    while (true) {
+        Node* cur = t->slots[idx].load(std::memory_order_relaxed);
+        if (!cur || cur == tombstone()) {
+            if (cur) s.tombstones--;
+            t->slots[idx].store(fresh, std::memory_order_release);
+            break;
+        }
+        idx = (idx + 1) & t->mask;
+    }
+    s.count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ClockCache::remove(const std::string& key) {
+    uint64_t h = hash_key(key);
+    Shard& s = shard_for(h);
+
+    std::lock_guard<std::mutex> lock(s.write_mutex);
+    Table* t = s.table.load(std::memory_order_relaxed);
+    size_t idx = find_slot(t, h, key);
+    if (idx == SIZE_MAX) return;
+
+    Node* old = t->slots[idx].load(std::memory_order_relaxed);
+    t->slots[idx].store(tombstone(), std::memory_order_release);
+    s.tombstones++;
+    s.count.fetch_sub(1, std::memory_order_relaxed);
+    retire(old);
+}
+
+size_t ClockCache::size() const {
+    size_t total = 0;
+    for (const auto& s : shards_) total += s->count.load(std::memory_order_relaxed);
+    return total;
+}
+
+CacheStats ClockCache::stats() const {
+    CacheStats st;
+    st.hits = hits_.load();
+    st.misses = misses_.load();
+    for (const auto& s : shards_) {
+        st.entries += s->count.load(std::memory_order_relaxed);
+        st.evictions += s->evictions.load(std::memory_order_relaxed);
+    }
+    return st;
+}
+
+void ClockCache::entries(std::vector<Entry>& out) const {
+    out.reserve(out.size() + size());
+    for (const auto& s : shards_) {
+        std::lock_guard<std::mutex> lock(s->write_mutex);
+        Table* t = s->table.load(std::memory_order_relaxed);
+        for (bool referenced : {false, true}) {
+            for (size_t i = 0; i <= t->mask; ++i) {
+                Node* n = t->slots[i].load(std::memory_order_relaxed);
+                if (n && n != tombstone() && n->referenced.load(std::memory_order_relaxed) == referenced)
+                    out.emplace_back(n->key, n->value);
+            }
+        }
+    }
+}
+
+size_t ClockCache::find_slot(Table* t, uint64_t hash, const std::string& key) const {
+    size_t idx = hash & t->mask;
+    for (size_t probes = 0; probes <= t->mask; ++probes) {
+        Node* n = t->slots[idx].load(std::memory_order_relaxed);
+        if (!n) break;
+        if (n != tombstone() && n->hash == hash && n->key == key) return idx;
+        idx = (idx + 1) & t->mask;
+    }
+    return SIZE_MAX;
+}
+
+// Sweep the hand, giving referenced entries a second chance, and unlink the
+// first entry whose bit is already clear.
+void ClockCache::evict_one(Shard& s) {
+    Table* t = s.table.load(std::memory_order_relaxed);
+    while (true) {
+        size_t idx = s.hand;
+        s.hand = (s.hand + 1) & t->mask;
+
+        Node* n = t->slots[idx].load(std::memory_order_relaxed);
+        if (!n || n == tombstone()) continue;
+        if (n->referenced.load(std::memory_order_relaxed)) {
+            n->referenced.store(false, std::memory_order_relaxed);
+            continue;
+        }
+        t->slots[idx].store(tombstone(), std::memory_order_release);
+        s.tombstones++;
+        s.count.fetch_sub(1, std::memory_order_relaxed);
+        s.evictions.fetch_add(1, std::memory_order_relaxed);
+        retire(n);
+        return;
+    }
+}
+
+// Re-pack live entries into a fresh table to drop tombstones. Readers that
+// still hold the old table keep probing it until their epoch ends.
+void ClockCache::rebuild(Shard& s) {
+    Table* old = s.table.load(std::memory_order_relaxed);
+    Table* t = new Table(old->mask + 1);
+    for (size_t i = 0; i <= old->mask; ++i) {
+        Node* n = old->slots[i].load(std::memory_order_relaxed);
+        if (!n || n == tombstone()) continue;
+        size_t idx = n->hash & t->mask;
+        while (t->slots[idx].load(std::memory_order_relaxed)) idx = (idx + 1) & t->mask;
+        t->slots[idx].store(n, std::memory_order_relaxed);
+    }
+    s.table.store(t, std::memory_order_release);
+    s.tombstones = 0;
+    s.hand = 0;
+    EpochManager::instance().retire([old] { delete old; });
+}
+
+void ClockCache::retire(Node* n) {
+    EpochManager::instance().retire([n] { delete n; });
+}
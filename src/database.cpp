@@ -1,6 +1,125 @@
 #include "database.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
+namespace {
+
+// pg_type OIDs
+constexpr Oid kTextOid = 25;
+constexpr Oid kByteaOid = 17;
+constexpr Oid kTextArrayOid = 1009;
+constexpr Oid kInt8Oid = 20;
+
+// {"a","b\"c"} — text-format array literal for a text[] parameter
+std::string text_array(const std::vector<const std::string*>& items) {
+    std::string out = "{";
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (i) out += ',';
+        out += '"';
+        for (char c : *items[i]) {
+            if (c == '"' || c == '\\') out += '\\';
+            out += c;
+        }
+        out += '"';
+    }
+    out += '}';
+    return out;
+}
+
+// Older tables stored the value as TEXT; convert them in place once.
+const char* kMigrateValueColumn =
+    "DO $$ BEGIN "
+    "IF (SELECT data_type FROM information_schema.columns "
+    "    WHERE table_name = 'kv_store' AND column_name = 'value') = 'text' THEN "
+    "  ALTER TABLE kv_store ALTER COLUMN value TYPE BYTEA USING convert_to(value, 'UTF8'); "
+    "END IF; END $$";
+
+// The primary key index only serves LIKE 'prefix%' under the C collation;
+// elsewhere prefix scans need an index in byte order of their own.
+const char* kPatternIndex =
+    "DO $$ BEGIN "
+    "IF (SELECT datcollate FROM pg_database WHERE datname = current_database()) "
+    "   NOT IN ('C', 'POSIX') THEN "
+    "  CREATE INDEX IF NOT EXISTS kv_store_key_pattern ON kv_store (key text_pattern_ops); "
+    "END IF; END $$";
+
+// LIKE pattern matching every key that starts with prefix. Unlike a
+// computed upper bound, it is right under any collation, and the planner
+// turns it into an index range.
+std::string like_prefix(const std::string& prefix) {
+    std::string out;
+    out.reserve(prefix.size() + 1);
+    for (char c : prefix) {
+        if (c == '%' || c == '_' || c == '\\') out += '\\';
+        out += c;
+    }
+    out += '%';
+    return out;
+}
+
+// Binary COPY: an 11-byte signature, flags:i32 and extension length:i32
+// (then the extension), tuples of field count:i16 and length:i32 + bytes
+// per field, and a field count of -1 to finish. Big-endian throughout.
+constexpr char kCopySignature[] = "PGCOPY\n\377\r\n";
+constexpr size_t kCopyHeader = sizeof(kCopySignature) + 8;
+
+uint32_t read_be32(const char* p) {
+    const auto* b = reinterpret_cast<const unsigned char*>(p);
+    return uint32_t(b[0]) << 24 | uint32_t(b[1]) << 16 | uint32_t(b[2]) << 8 | b[3];
+}
+
+// One CopyData message, which holds whole tuples: the first also carries
+// the header and the last the trailer. Rows with a NULL value are skipped.
+bool read_copy_rows(const char* p, size_t n, bool& header, const Storage::RowSink& sink) {
+    const char* end = p + n;
+    if (header) {
+        if (n < kCopyHeader || std::memcmp(p, kCopySignature, sizeof(kCopySignature)) != 0) return false;
+        size_t ext = read_be32(p + kCopyHeader - 4);
+        if (n - kCopyHeader < ext) return false;
+        p += kCopyHeader + ext;
+        header = false;
+    }
+    while (end - p >= 2) {
+        int16_t fields = static_cast<int16_t>(uint16_t(uint8_t(p[0])) << 8 | uint8_t(p[1]));
+        p += 2;
+        if (fields == -1) return p == end;
+        if (fields != 2) return false;
+        std::string cols[2];
+        bool null = false;
+        for (std::string& col : cols) {
+            if (end - p < 4) return false;
+            int32_t len = static_cast<int32_t>(read_be32(p));
+            p += 4;
+            if (len < 0) {
+                null = true;
+                continue;
+            }
+            if (end - p < len) return false;
+            col.assign(p, static_cast<size_t>(len));
+            p += len;
+        }
+        if (!null) sink(std::move(cols[0]), std::move(cols[1]));
+    }
+    return p == end;
+}
+
+class ScopedTimer {
+public:
+    using Clock = std::chrono::steady_clock;
+    explicit ScopedTimer(uint64_t& out) : out_(out), start_(Clock::now()) {}
+    ~ScopedTimer() {
+        out_ = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start_).count();
+    }
+private:
+    uint64_t& out_;
+    Clock::time_point start_;
+};
+
+} // namespace
+
 Database::Database(const std::string& conn_string)
     : conninfo_(conn_string), conn_handle_(nullptr) {}
 
@@ -16,59 +135,441 @@ bool Database::connect() {
         std::cerr << "DB connection failed: " << PQerrorMessage(conn_handle_) << "\n";
         return false;
     }
-    
-    const char* sql = "CREATE TABLE IF NOT EXISTS kv_store (key VARCHAR(255) PRIMARY KEY, value TEXT)";
-    return execute(sql);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    return prepare_statements();
+}
+
+bool Database::create_schema(const std::string& conn_string) {
+    Database db(conn_string);
+    db.conn_handle_ = PQconnectdb(conn_string.c_str());
+    if (PQstatus(db.conn_handle_) != CONNECTION_OK) {
+        std::cerr << "DB connection failed: " << PQerrorMessage(db.conn_handle_) << "\n";
+        return false;
+    }
+    const char* sql = "CREATE TABLE IF NOT EXISTS kv_store (key VARCHAR(255) PRIMARY KEY, value BYTEA)";
+    return db.execute(sql) && db.execute(kMigrateValueColumn) && db.execute(kPatternIndex);
+}
+
+bool Database::prepare_statements(bool send_only) {
+    const Oid put_types[2] = {kTextOid, kByteaOid};
+    const Oid key_type[1] = {kTextOid};
+    const Oid keys_type[1] = {kTextArrayOid};
+    return prepare("kv_put",
+                   "INSERT INTO kv_store (key, value) VALUES ($1, $2) "
+                   "ON CONFLICT (key) DO UPDATE SET value = EXCLUDED.value",
+                   2, put_types, send_only) &&
+           prepare("kv_get", "SELECT value FROM kv_store WHERE key = $1", 1, key_type, send_only) &&
+           prepare("kv_del", "DELETE FROM kv_store WHERE key = $1", 1, key_type, send_only) &&
+           prepare("kv_mget", "SELECT key, value FROM kv_store WHERE key = ANY($1)", 1, keys_type, send_only);
 }
 
 bool Database::execute(const std::string& query) {
     std::lock_guard<std::mutex> lock(mutex_);
-    PGresult* res = PQexec(conn_handle_, query.c_str());
+    return execute_locked(query.c_str());
+}
+
+bool Database::execute_locked(const char* query) {
+    PGresult* res = PQexec(conn_handle_, query);
     if (!res) return false;
     
     bool ok = (PQresultStatus(res) == PGRES_COMMAND_OK || PQresultStatus(res) == PGRES_TUPLES_OK);
+    if (!ok) std::cerr << "DB query failed: " << PQerrorMessage(conn_handle_) << "\n";
+    PQclear(res);
+    return ok;
+}
+
+bool Database::prepare(const char* name, const char* sql, int nparams, const Oid* types, bool send_only) {
+    if (send_only) {
+        bool sent = PQsendPrepare(conn_handle_, name, sql, nparams, types) == 1;
+        if (!sent) std::cerr << "DB prepare " << name << " failed: " << PQerrorMessage(conn_handle_) << "\n";
+        return sent;
+    }
+    PGresult* res = PQprepare(conn_handle_, name, sql, nparams, types);
+    bool ok = res && PQresultStatus(res) == PGRES_COMMAND_OK;
+    if (!ok) std::cerr << "DB prepare " << name << " failed: " << PQerrorMessage(conn_handle_) << "\n";
     PQclear(res);
     return ok;
 }
 
 bool Database::put(const std::string& key, const std::string& value) {
+    uint64_t us;
+    bool ok;
+    {
+        ScopedTimer t(us);
+        std::lock_guard<std::mutex> lock(mutex_);
+        const char* params[2] = {key.c_str(), value.data()};
+        const int lengths[2] = {0, static_cast<int>(value.size())};
+        const int formats[2] = {0, 1};
+        PGresult* res = PQexecPrepared(conn_handle_, "kv_put", 2, params, lengths, formats, 0);
+        ok = res && PQresultStatus(res) == PGRES_COMMAND_OK;
+        PQclear(res);
+    }
+    put_timer_.record(us);
+    return ok;
+}
+
+bool Database::get(const std::string& key, std::optional<std::string>& value) {
+    uint64_t us;
+    bool ok;
+    value.reset();
+    {
+        ScopedTimer t(us);
+        std::lock_guard<std::mutex> lock(mutex_);
+        const char* params[1] = {key.c_str()};
+        PGresult* res = PQexecPrepared(conn_handle_, "kv_get", 1, params, nullptr, nullptr, 1);
+        ok = res && PQresultStatus(res) == PGRES_TUPLES_OK;
+        if (!ok) std::cerr << "DB get failed: " << PQerrorMessage(conn_handle_) << "\n";
+        if (ok && PQntuples(res) > 0) {
+            value.emplace(PQgetvalue(res, 0, 0), PQgetlength(res, 0, 0));
+        }
+        PQclear(res);
+    }
+    get_timer_.record(us);
+    return ok;
+}
+
+bool Database::remove(const std::string& key) {
+    uint64_t us;
+    bool ok;
+    {
+        ScopedTimer t(us);
+        std::lock_guard<std::mutex> lock(mutex_);
+        const char* params[1] = {key.c_str()};
+        PGresult* res = PQexecPrepared(conn_handle_, "kv_del", 1, params, nullptr, nullptr, 0);
+        ok = res && PQresultStatus(res) == PGRES_COMMAND_OK;
+        PQclear(res);
+    }
+    remove_timer_.record(us);
+    return ok;
+}
+
+bool Database::get_many(const std::vector<const std::string*>& keys,
+                        std::vector<std::optional<std::string>>& values) {
+    values.assign(keys.size(), std::nullopt);
+    if (keys.empty()) return true;
+
+    // a key may be asked for more than once; every position gets the row
+    std::unordered_multimap<std::string_view, size_t> index;
+    index.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) index.emplace(*keys[i], i);
+    std::string array = text_array(keys);
+
+    uint64_t us;
+    bool ok;
+    {
+        ScopedTimer t(us);
+        std::lock_guard<std::mutex> lock(mutex_);
+        const char* params[1] = {array.c_str()};
+        PGresult* res = PQexecPrepared(conn_handle_, "kv_mget", 1, params, nullptr, nullptr, 1);
+        ok = res && PQresultStatus(res) == PGRES_TUPLES_OK;
+        if (!ok) std::cerr << "DB multi-get failed: " << PQerrorMessage(conn_handle_) << "\n";
+        for (int r = 0; ok && r < PQntuples(res); ++r) {
+            auto range = index.equal_range(std::string_view(PQgetvalue(res, r, 0), PQgetlength(res, r, 0)));
+            for (auto it = range.first; it != range.second; ++it)
+                values[it->second].emplace(PQgetvalue(res, r, 1), PQgetlength(res, r, 1));
+        }
+        PQclear(res);
+    }
+    get_timer_.record(us);
+    return ok;
+}
+
+bool Database::scan_open(const std::string& prefix, const std::string& start, size_t limit) {
     std::lock_guard<std::mutex> lock(mutex_);
-    const char* params[2] = {key.c_str(), value.c_str()};
+    if (!execute_locked("BEGIN READ ONLY")) return false;
+
+    const std::string& from = std::max(prefix, start);
+    std::string pattern = like_prefix(prefix);
+    std::string limit_text = std::to_string(limit);
+    const char* params[3] = {from.c_str(), pattern.c_str(), limit ? limit_text.c_str() : nullptr};
+    const Oid types[3] = {kTextOid, kTextOid, kInt8Oid};
     PGresult* res = PQexecParams(conn_handle_,
-        "INSERT INTO kv_store (key, value) VALUES ($1, $2) ON CONFLICT (key) DO UPDATE SET value = $2",
-        2, NULL, params, NULL, NULL, 0);
-    if (!res) return false;
-    bool ok = (PQresultStatus(res) == PGRES_COMMAND_OK);
+                                 "DECLARE kv_scan NO SCROLL CURSOR FOR "
+                                 "SELECT key, value FROM kv_store "
+                                 "WHERE key >= $1 AND key LIKE $2 "
+                                 "ORDER BY key LIMIT $3",
+                                 3, types, params, nullptr, nullptr, 0);
+    bool ok = res && PQresultStatus(res) == PGRES_COMMAND_OK;
     PQclear(res);
+    if (!ok) {
+        std::cerr << "DB scan failed: " << PQerrorMessage(conn_handle_) << "\n";
+        execute_locked("ROLLBACK");
+    }
+    return ok;
+}
+
+bool Database::scan_fetch(size_t n, std::vector<Row>& rows) {
+    rows.clear();
+    std::string sql = "FETCH " + std::to_string(n) + " FROM kv_scan";
+    uint64_t us;
+    bool ok;
+    {
+        ScopedTimer t(us);
+        std::lock_guard<std::mutex> lock(mutex_);
+        PGresult* res = PQexecParams(conn_handle_, sql.c_str(), 0, nullptr, nullptr, nullptr, nullptr, 1);
+        ok = res && PQresultStatus(res) == PGRES_TUPLES_OK;
+        if (!ok) std::cerr << "DB scan fetch failed: " << PQerrorMessage(conn_handle_) << "\n";
+        for (int r = 0; ok && r < PQntuples(res); ++r) {
+            rows.emplace_back(std::string(PQgetvalue(res, r, 0), PQgetlength(res, r, 0)),
+                              std::string(PQgetvalue(res, r, 1), PQgetlength(res, r, 1)));
+        }
+        PQclear(res);
+    }
+    scan_timer_.record(us);
     return ok;
 }
 
-std::optional<std::string> Database::get(const std::string& key) {
+// Ending the transaction closes the cursor; a failed one rolls back.
+void Database::scan_close() {
     std::lock_guard<std::mutex> lock(mutex_);
-    const char* params[1] = {key.c_str()};
-    PGresult* res = PQexecParams(conn_handle_,
-        "SELECT value FROM kv_store WHERE key = $1",
-        1, NULL, params, NULL, NULL, 0);
-    if (!res) return std::nullopt;
-    
-    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) == 0) {
+    execute_locked("COMMIT");
+    if (PQstatus(conn_handle_) != CONNECTION_OK) reconnect_locked();
+}
+
+bool Database::dump(const DumpFilter& filter, const RowSink& sink) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto literal = [this](const std::string& s) {
+        char* escaped = PQescapeLiteral(conn_handle_, s.data(), s.size());
+        std::string out = escaped ? escaped : "NULL";
+        PQfreemem(escaped);
+        return out;
+    };
+
+    // COPY takes no parameters, so the filter goes in as literals
+    std::string sql = "COPY (SELECT key, value FROM kv_store WHERE true";
+    if (!filter.prefix.empty()) sql += " AND key LIKE " + literal(like_prefix(filter.prefix));
+    if (filter.keys) {
+        std::vector<const std::string*> keys;
+        keys.reserve(filter.num_keys);
+        for (size_t i = 0; i < filter.num_keys; ++i) keys.push_back(&filter.keys[i]);
+        sql += " AND key = ANY(" + literal(text_array(keys)) + "::text[])";
+    }
+    if (filter.parts > 1) {
+        // Disjoint ranges of heap blocks, so each session reads only its
+        // own pages (a TID range scan on Postgres 14 and later). The last
+        // range is left open for pages added since the size was read.
+        PGresult* res = PQexec(conn_handle_,
+                               "SELECT pg_relation_size('kv_store') / current_setting('block_size')::int");
+        if (!res || PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1) {
+            std::cerr << "DB dump failed: " << PQerrorMessage(conn_handle_) << "\n";
+            PQclear(res);
+            return false;
+        }
+        uint64_t pages = std::strtoull(PQgetvalue(res, 0, 0), nullptr, 10);
         PQclear(res);
-        return std::nullopt;
+        auto block = [&](uint32_t part) {
+            return "'(" + std::to_string(pages * part / filter.parts) + ",0)'::tid";
+        };
+        if (filter.part > 0) sql += " AND ctid >= " + block(filter.part);
+        if (filter.part + 1 < filter.parts) sql += " AND ctid < " + block(filter.part + 1);
     }
-    
-    std::string value = PQgetvalue(res, 0, 0);
+    if (filter.limit) sql += " LIMIT " + std::to_string(filter.limit);
+    sql += ") TO STDOUT (FORMAT binary)";
+
+    PGresult* res = PQexec(conn_handle_, sql.c_str());
+    bool ok = res && PQresultStatus(res) == PGRES_COPY_OUT;
     PQclear(res);
-    return value;
+    if (ok) {
+        // read to the end even after a bad message, or the session is stuck in COPY
+        bool header = true;
+        char* buf;
+        int n;
+        while ((n = PQgetCopyData(conn_handle_, &buf, 0)) > 0) {
+            ok = ok && read_copy_rows(buf, static_cast<size_t>(n), header, sink);
+            PQfreemem(buf);
+        }
+        ok = ok && n == -1;
+        while ((res = PQgetResult(conn_handle_))) {
+            ok = ok && PQresultStatus(res) == PGRES_COMMAND_OK;
+            PQclear(res);
+        }
+    }
+    if (!ok) std::cerr << "DB dump failed: " << PQerrorMessage(conn_handle_) << "\n";
+    return ok;
 }
 
-bool Database::remove(const std::string& key) {
+bool Database::load_epoch(std::string& token) {
+    token.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    PGresult* res = PQexec(conn_handle_, "SELECT value FROM kv_meta WHERE name = 'cache_epoch'");
+    bool ok = res && PQresultStatus(res) == PGRES_TUPLES_OK;
+    if (ok && PQntuples(res) > 0) {
+        token.assign(PQgetvalue(res, 0, 0), PQgetlength(res, 0, 0));
+    } else if (!ok) {
+        // no kv_meta yet: no snapshot was ever taken against this database
+        const char* state = res ? PQresultErrorField(res, PG_DIAG_SQLSTATE) : nullptr;
+        ok = state && std::string_view(state) == "42P01";
+        if (!ok) std::cerr << "DB epoch read failed: " << PQerrorMessage(conn_handle_) << "\n";
+    }
+    PQclear(res);
+    return ok;
+}
+
+bool Database::store_epoch(const std::string& token) {
     std::lock_guard<std::mutex> lock(mutex_);
-    const char* params[1] = {key.c_str()};
+    // taken at shutdown, possibly on a session that dropped while idle
+    if (PQstatus(conn_handle_) != CONNECTION_OK) reconnect_locked();
+    if (!execute_locked("CREATE TABLE IF NOT EXISTS kv_meta (name TEXT PRIMARY KEY, value TEXT)"))
+        return false;
+    const char* params[1] = {token.c_str()};
     PGresult* res = PQexecParams(conn_handle_,
-        "DELETE FROM kv_store WHERE key = $1",
-        1, NULL, params, NULL, NULL, 0);
-    if (!res) return false;
-    bool ok = (PQresultStatus(res) == PGRES_COMMAND_OK);
+                                 "INSERT INTO kv_meta (name, value) VALUES ('cache_epoch', $1) "
+                                 "ON CONFLICT (name) DO UPDATE SET value = EXCLUDED.value",
+                                 1, nullptr, params, nullptr, nullptr, 0);
+    bool ok = res && PQresultStatus(res) == PGRES_COMMAND_OK;
+    if (!ok) std::cerr << "DB epoch write failed: " << PQerrorMessage(conn_handle_) << "\n";
     PQclear(res);
     return ok;
-}
\ No newline at end of file
+}
+
+bool Database::send_prepared(const DBOp& op) {
+    switch (op.kind) {
+    case DBOp::Kind::Put: {
+        const char* params[2] = {op.key->c_str(), op.value->data()};
+        const int lengths[2] = {0, static_cast<int>(op.value->size())};
+        const int formats[2] = {0, 1};
+        return PQsendQueryPrepared(conn_handle_, "kv_put", 2, params, lengths, formats, 0);
+    }
+    case DBOp::Kind::Get: {
+        const char* params[1] = {op.key->c_str()};
+        return PQsendQueryPrepared(conn_handle_, "kv_get", 1, params, nullptr, nullptr, 1);
+    }
+    case DBOp::Kind::Remove: {
+        const char* params[1] = {op.key->c_str()};
+        return PQsendQueryPrepared(conn_handle_, "kv_del", 1, params, nullptr, nullptr, 0);
+    }
+    }
+    return false;
+}
+
+bool Database::run_pipeline(DBOp* const* ops, size_t n) {
+    uint64_t us;
+    bool ok = true;
+    {
+        ScopedTimer t(us);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!PQenterPipelineMode(conn_handle_)) return false;
+
+        for (size_t i = 0; i < n && ok; ++i) ok = send_prepared(*ops[i]);
+        ok = ok && PQpipelineSync(conn_handle_);
+
+        // one result plus a terminating NULL per statement, then the sync
+        for (size_t i = 0; i < n && ok; ++i) {
+            DBOp& op = *ops[i];
+            PGresult* res = PQgetResult(conn_handle_);
+            if (!res) {
+                ok = false;
+                break;
+            }
+            read_result(op, res);
+            PQclear(res);
+            PQclear(PQgetResult(conn_handle_));
+        }
+        if (ok) {
+            PGresult* res = PQgetResult(conn_handle_);
+            ok = res && PQresultStatus(res) == PGRES_PIPELINE_SYNC;
+            PQclear(res);
+        }
+
+        if (!ok) {
+            std::cerr << "DB pipeline failed: " << PQerrorMessage(conn_handle_) << "\n";
+            reconnect_locked();
+        } else {
+            PQexitPipelineMode(conn_handle_);
+        }
+    }
+    for (size_t i = 0; i < n; ++i) timer_for(ops[i]->kind).record(us);
+    return ok;
+}
+
+bool Database::write_batch(const std::vector<KeyValue>& upserts,
+                           const std::vector<const std::string*>& deletes) {
+    uint64_t us;
+    bool ok;
+    {
+        ScopedTimer t(us);
+        std::lock_guard<std::mutex> lock(mutex_);
+        // the write-behind flusher owns this connection and retries failed
+        // batches; each retry gets a fresh session if the old one dropped
+        if (PQstatus(conn_handle_) != CONNECTION_OK) reconnect_locked();
+        ok = execute_locked("BEGIN");
+
+        if (ok && !upserts.empty()) {
+            std::string sql = "INSERT INTO kv_store (key, value) VALUES ";
+            std::vector<const char*> params;
+            std::vector<int> lengths, formats;
+            std::vector<Oid> types;
+            for (size_t i = 0; i < upserts.size(); ++i) {
+                sql += (i ? ",($" : "($") + std::to_string(2 * i + 1) + ",$" + std::to_string(2 * i + 2) + ")";
+                params.push_back(upserts[i].first->c_str());
+                params.push_back(upserts[i].second->data());
+                lengths.push_back(0);
+                lengths.push_back(static_cast<int>(upserts[i].second->size()));
+                formats.push_back(0);
+                formats.push_back(1);
+                types.push_back(kTextOid);
+                types.push_back(kByteaOid);
+            }
+            sql += " ON CONFLICT (key) DO UPDATE SET value = EXCLUDED.value";
+            PGresult* res = PQexecParams(conn_handle_, sql.c_str(), static_cast<int>(params.size()),
+                                         types.data(), params.data(), lengths.data(), formats.data(), 0);
+            ok = res && PQresultStatus(res) == PGRES_COMMAND_OK;
+            PQclear(res);
+        }
+        if (ok && !deletes.empty()) {
+            std::string keys = text_array(deletes);
+            const char* params[1] = {keys.c_str()};
+            const Oid types[1] = {kTextArrayOid};
+            PGresult* res = PQexecParams(conn_handle_, "DELETE FROM kv_store WHERE key = ANY($1)",
+                                         1, types, params, nullptr, nullptr, 0);
+            ok = res && PQresultStatus(res) == PGRES_COMMAND_OK;
+            PQclear(res);
+        }
+
+        if (ok) {
+            ok = execute_locked("COMMIT");
+        } else {
+            std::cerr << "DB batch write failed: " << PQerrorMessage(conn_handle_) << "\n";
+            execute_locked("ROLLBACK");
+        }
+    }
+    if (!upserts.empty()) put_timer_.record(us);
+    if (!deletes.empty()) remove_timer_.record(us);
+    return ok;
+}
+
+void Database::read_result(DBOp& op, const PGresult* res) {
+    ExecStatusType st = PQresultStatus(res);
+    if (op.kind == DBOp::Kind::Get) {
+        op.ok = (st == PGRES_TUPLES_OK);
+        if (op.ok && PQntuples(res) > 0)
+            op.result.emplace(PQgetvalue(res, 0, 0), PQgetlength(res, 0, 0));
+    } else {
+        op.ok = (st == PGRES_COMMAND_OK);
+    }
+}
+
+// A fresh session leaves pipeline and nonblocking mode but loses the
+// prepared statements.
+bool Database::reconnect_locked() {
+    PQreset(conn_handle_);
+    return PQstatus(conn_handle_) == CONNECTION_OK && prepare_statements();
+}
+
+LatencyTimer& Database::timer_for(DBOp::Kind kind) {
+    switch (kind) {
+    case DBOp::Kind::Put: return put_timer_;
+    case DBOp::Kind::Get: return get_timer_;
+    default: return remove_timer_;
+    }
+}
+
+DBStats Database::stats() const {
+    DBStats s;
+    s.put = put_timer_.load();
+    s.get = get_timer_.load();
+    s.remove = remove_timer_.load();
+    s.scan = scan_timer_.load();
+    return s;
+}
@@ -0,0 +1,102 @@
+#include "db_pipeline.h"
+#include <iostream>
+
+DBPipeline::DBPipeline(const std::string& conninfo, size_t num_connections) {
+    for (size_t i = 0; i < num_connections; ++i) {
+        auto db = std::make_unique<Database>(conninfo);
+        if (!db->connect()) {
+            std::cerr << "DB pipeline: failed to connect connection " << i << "\n";
+            return;
+        }
+        conns_.push_back(std::move(db));
+    }
+    for (auto& db : conns_) senders_.emplace_back(&DBPipeline::sender_loop, this, std::ref(*db));
+    connected_ = !conns_.empty();
+}
+
+DBPipeline::~DBPipeline() {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : senders_) t.join();
+}
+
+bool DBPipeline::put(const std::string& key, const std::string& value) {
+    Pending p;
+    p.op.kind = DBOp::Kind::Put;
+    p.op.key = &key;
+    p.op.value = &value;
+    submit(p);
+    return p.op.ok;
+}
+
+bool DBPipeline::get(const std::string& key, std::optional<std::string>& value) {
+    Pending p;
+    p.op.kind = DBOp::Kind::Get;
+    p.op.key = &key;
+    submit(p);
+    value = std::move(p.op.result);
+    return p.op.ok;
+}
+
+bool DBPipeline::remove(const std::string& key) {
+    Pending p;
+    p.op.kind = DBOp::Kind::Remove;
+    p.op.key = &key;
+    submit(p);
+    return p.op.ok;
+}
+
+DBStats DBPipeline::stats() const {
+    DBStats total;
+    for (const auto& db : conns_) total += db->stats();
+    return total;
+}
+
+void DBPipeline::submit(Pending& p) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    if (stopping_ || !connected_) return;
+    queue_.push_back(&p);
+    cv_.notify_one();
+    p.cv.wait(lock, [&] { return p.done; });
+}
+
+// Takes everything queued so far, so the batch grows with the load: an idle
+// server sends single statements, a busy one fills the pipeline while the
+// previous batch is on the wire.
+void DBPipeline::sender_loop(Database& db) {
+    std::vector<Pending*> batch;
+    std::vector<DBOp*> ops;
+    batch.reserve(kMaxBatch);
+    ops.reserve(kMaxBatch);
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            cv_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) return;
+            while (!queue_.empty() && batch.size() < kMaxBatch) {
+                batch.push_back(queue_.front());
+                queue_.pop_front();
+            }
+            if (!queue_.empty()) cv_.notify_one();   // leftovers for another sender
+        }
+
+        for (Pending* p : batch) ops.push_back(&p->op);
+        db.run_pipeline(ops.data(), ops.size());
+        batches_.fetch_add(1, std::memory_order_relaxed);
+        batched_.fetch_add(batch.size(), std::memory_order_relaxed);
+
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            for (Pending* p : batch) {
+                p->done = true;
+                p->cv.notify_one();
+            }
+        }
+        batch.clear();
+        ops.clear();
+    }
+}
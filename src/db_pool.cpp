@@ -1,45 +1,124 @@
 #include "db_pool.h"
 #include <iostream>
 
-DBConnectionPool::DBConnectionPool(const std::string& conninfo, size_t pool_size) {
+namespace {
+// last connection this thread used, per pool
+thread_local const DBConnectionPool* tl_pool = nullptr;
+thread_local size_t tl_index = 0;
+}
+
+DBConnectionPool::DBConnectionPool(const Opener& open, size_t pool_size, bool affinity)
+    : slots_(new Slot[pool_size]), affinity_(affinity) {
     conns_.reserve(pool_size);
-    in_use_.assign(pool_size, false);
 
     for (size_t i = 0; i < pool_size; ++i) {
-        auto db = std::make_unique<Database>(conninfo);
+        std::unique_ptr<Storage> db = open();
         if (!db->connect()) {
             std::cerr << "DB pool: failed to connect connection " << i << "\n";
             connected_ = false;
             return;
         }
+        index_of_[db.get()] = i;
         conns_.push_back(std::move(db));
     }
+    for (size_t i = pool_size; i-- > 0;) {
+        slots_[i].listed.store(true, std::memory_order_relaxed);
+        push(i);
+    }
     connected_ = true;
 }
 
-Database* DBConnectionPool::acquire() {
-    std::unique_lock<std::mutex> lock(mtx_);
-    cv_.wait(lock, [&]{
-        for (bool used : in_use_) if (!used) return true;
-        return false;
-    });
+Storage* DBConnectionPool::acquire(std::chrono::milliseconds timeout) {
+    if (conns_.empty()) return nullptr;
 
-    for (size_t i = 0; i < conns_.size(); ++i) {
-        if (!in_use_[i]) {
-            in_use_[i] = true;
-            return conns_[i].get();
+    size_t i;
+    if (!try_acquire(i)) {
+        // Slow path. waiters_ is raised under the lock before the last
+        // look at the stack, and release() checks it after pushing, so a
+        // connection freed in between is either seen here or notified.
+        std::unique_lock<std::mutex> lock(wait_mtx_);
+        waiters_.fetch_add(1);
+        auto got = [&] { return try_acquire(i); };
+        bool ok;
+        if (timeout.count() > 0) {
+            ok = cv_.wait_for(lock, timeout, got);
+        } else {
+            cv_.wait(lock, got);
+            ok = true;
+        }
+        waiters_.fetch_sub(1);
+        if (!ok) {
+            timeouts_.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
         }
     }
-    return nullptr; // should not happen
+
+    tl_pool = this;
+    tl_index = i;
+    return conns_[i].get();
 }
 
-void DBConnectionPool::release(Database* db) {
-    std::unique_lock<std::mutex> lock(mtx_);
-    for (size_t i = 0; i < conns_.size(); ++i) {
-        if (conns_[i].get() == db) {
-            in_use_[i] = false;
-            cv_.notify_one();
-            return;
+void DBConnectionPool::release(Storage* db) {
+    auto it = index_of_.find(db);
+    if (it == index_of_.end()) return;
+    size_t i = it->second;
+
+    slots_[i].busy.store(false, std::memory_order_release);
+    if (!slots_[i].listed.exchange(true)) push(i);
+
+    if (waiters_.load() > 0) {
+        std::lock_guard<std::mutex> lock(wait_mtx_);
+        cv_.notify_one();
+    }
+}
+
+DBStats DBConnectionPool::stats() const {
+    DBStats total;
+    for (const auto& db : conns_) total += db->stats();
+    return total;
+}
+
+bool DBConnectionPool::try_acquire(size_t& i) {
+    if (affinity_ && tl_pool == this) {
+        bool expected = false;
+        if (slots_[tl_index].busy.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            affinity_hits_.fetch_add(1, std::memory_order_relaxed);
+            i = tl_index;
+            return true;
+        }
+    }
+    // a popped index may have been claimed through affinity meanwhile;
+    // its holder pushes it again on release since listed is now false
+    while (pop(i)) {
+        slots_[i].listed.store(false);
+        bool expected = false;
+        if (slots_[i].busy.compare_exchange_strong(expected, true, std::memory_order_acquire))
+            return true;
+    }
+    return false;
+}
+
+void DBConnectionPool::push(size_t i) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+        slots_[i].next.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        next = ((head >> 32) + 1) << 32 | (i + 1);
+    } while (!head_.compare_exchange_weak(head, next, std::memory_order_release,
+                                          std::memory_order_relaxed));
+}
+
+bool DBConnectionPool::pop(size_t& i) {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    while (true) {
+        uint32_t top = static_cast<uint32_t>(head);
+        if (top == kNil) return false;
+        uint32_t below = slots_[top - 1].next.load(std::memory_order_relaxed);
+        uint64_t next = ((head >> 32) + 1) << 32 | below;
+        if (head_.compare_exchange_weak(head, next, std::memory_order_acquire,
+                                        std::memory_order_acquire)) {
+            i = top - 1;
+            return true;
         }
     }
 }
@@ -0,0 +1,88 @@
+#include "epoch.h"
+#include <thread>
+#include <algorithm>
+
+// Per-thread slot ownership; the slot is handed back when the thread exits.
+struct ThreadSlotOwner {
+    size_t slot = SIZE_MAX;
+    int depth = 0;
+
+    ~ThreadSlotOwner() {
+        if (slot != SIZE_MAX) EpochManager::instance().release_slot(slot);
+    }
+};
+
+namespace {
+thread_local ThreadSlotOwner t_owner;
+}
+
+EpochManager& EpochManager::instance() {
+    static EpochManager mgr;
+    return mgr;
+}
+
+EpochManager::Guard::Guard() {
+    EpochManager& mgr = EpochManager::instance();
+    if (t_owner.slot == SIZE_MAX) t_owner.slot = mgr.claim_slot();
+    slot_ = t_owner.slot;
+
+    // nested guards keep the outer pin
+    if (t_owner.depth++ == 0) {
+        mgr.slots_[slot_].epoch.store(mgr.global_epoch_.load(std::memory_order_acquire),
+                                      std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+EpochManager::Guard::~Guard() {
+    if (--t_owner.depth == 0) {
+        EpochManager::instance().slots_[slot_].epoch.store(0, std::memory_order_release);
+    }
+}
+
+size_t EpochManager::claim_slot() {
+    while (true) {
+        for (size_t i = 0; i < kMaxThreads; ++i) {
+            bool expected = false;
+            if (!slots_[i].claimed.load(std::memory_order_relaxed) &&
+                slots_[i].claimed.compare_exchange_strong(expected, true)) {
+                return i;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+void EpochManager::release_slot(size_t slot) {
+    slots_[slot].epoch.store(0, std::memory_order_release);
+    slots_[slot].claimed.store(false, std::memory_order_release);
+}
+
+void EpochManager::retire(std::function<void()> deleter) {
+    std::lock_guard<std::mutex> lock(retire_mutex_);
+    retired_.push_back({global_epoch_.load(), std::move(deleter)});
+    if (++since_collect_ >= kCollectEvery) {
+        since_collect_ = 0;
+        try_advance();
+        collect();
+    }
+}
+
+// The epoch may only move forward once every pinned reader has seen it.
+void EpochManager::try_advance() {
+    uint64_t current = global_epoch_.load();
+    for (size_t i = 0; i < kMaxThreads; ++i) {
+        if (!slots_[i].claimed.load(std::memory_order_acquire)) continue;
+        uint64_t e = slots_[i].epoch.load();
+        if (e != 0 && e != current) return;
+    }
+    global_epoch_.compare_exchange_strong(current, current + 1);
+}
+
+void EpochManager::collect() {
+    uint64_t current = global_epoch_.load();
+    auto keep = std::partition(retired_.begin(), retired_.end(),
+                               [current](const Retired& r) { return r.epoch + 2 > current; });
+    for (auto it = keep; it != retired_.end(); ++it) it->deleter();
+    retired_.erase(keep, retired_.end());
+}
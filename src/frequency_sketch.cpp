@@ -0,0 +1,79 @@
+#include "frequency_sketch.h"
+#include <algorithm>
+
+namespace {
+constexpr uint64_t kSeeds[4] = {
+    0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL,
+    0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL,
+};
+}
+
+FrequencySketch::FrequencySketch(size_t capacity) {
+    size_t words = 1;
+    while (words * 4 < std::max<size_t>(capacity, 16)) words <<= 1;   // ~4 counters per entry
+    table_.assign(words, 0);
+    counter_mask_ = words * 16 - 1;
+
+    size_t door_words = 1;
+    while (door_words * 64 < std::max<size_t>(capacity, 64) * 8) door_words <<= 1;
+    doorkeeper_.assign(door_words, 0);
+    door_mask_ = door_words * 64 - 1;
+
+    sample_size_ = std::max<size_t>(capacity, 16) * 10;
+}
+
+uint64_t FrequencySketch::mix(uint64_t hash, int row) {
+    uint64_t h = (hash ^ kSeeds[row]) * 0xFF51AFD7ED558CCDULL;
+    return h ^ (h >> 32);
+}
+
+bool FrequencySketch::door_contains(uint64_t hash) const {
+    for (int i = 0; i < 2; ++i) {
+        size_t bit = mix(hash, i + 2) & door_mask_;
+        if (!(doorkeeper_[bit >> 6] & (1ULL << (bit & 63)))) return false;
+    }
+    return true;
+}
+
+bool FrequencySketch::door_insert(uint64_t hash) {
+    bool present = true;
+    for (int i = 0; i < 2; ++i) {
+        size_t bit = mix(hash, i + 2) & door_mask_;
+        uint64_t m = 1ULL << (bit & 63);
+        if (!(doorkeeper_[bit >> 6] & m)) {
+            present = false;
+            doorkeeper_[bit >> 6] |= m;
+        }
+    }
+    return present;
+}
+
+void FrequencySketch::increment(uint64_t hash) {
+    // first sighting only marks the doorkeeper
+    if (door_insert(hash)) {
+        for (int row = 0; row < 4; ++row) {
+            size_t idx = mix(hash, row) & counter_mask_;
+            uint64_t& word = table_[idx >> 4];
+            int shift = static_cast<int>(idx & 15) * 4;
+            if (((word >> shift) & 0xF) < 15) word += 1ULL << shift;
+        }
+    }
+    if (++additions_ >= sample_size_) reset();
+}
+
+uint32_t FrequencySketch::estimate(uint64_t hash) const {
+    uint32_t freq = 15;
+    for (int row = 0; row < 4; ++row) {
+        size_t idx = mix(hash, row) & counter_mask_;
+        int shift = static_cast<int>(idx & 15) * 4;
+        freq = std::min<uint32_t>(freq, (table_[idx >> 4] >> shift) & 0xF);
+    }
+    return freq + (door_contains(hash) ? 1 : 0);
+}
+
+// Aging: halve every counter and start a fresh doorkeeper.
+void FrequencySketch::reset() {
+    for (auto& word : table_) word = (word >> 1) & 0x7777777777777777ULL;
+    std::fill(doorkeeper_.begin(), doorkeeper_.end(), 0);
+    additions_ /= 2;
+}
@@ -0,0 +1,141 @@
+#include "http_parser.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Offset of the first '\n' in [p, end), or end - p if there is none.
+size_t find_lf(const char* p, const char* end) {
+    const char* start = p;
+#ifdef __SSE2__
+    const __m128i lf = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, lf)));
+        if (mask) return static_cast<size_t>(p - start) + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '\n') ++p;
+    return static_cast<size_t>(p - start);
+}
+
+bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        char x = a[i], y = b[i];
+        if (x >= 'A' && x <= 'Z') x += 'a' - 'A';
+        if (y >= 'A' && y <= 'Z') y += 'a' - 'A';
+        if (x != y) return false;
+    }
+    return true;
+}
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+    return s;
+}
+
+} // namespace
+
+HttpParser::Status HttpParser::parse(const char* data, size_t len) {
+    data_ = data;
+
+    while (state_ != State::Body) {
+        size_t lf = scan_pos_ + find_lf(data + scan_pos_, data + len);
+        if (lf >= len) {
+            scan_pos_ = len;
+            return len > kMaxHeaderBytes ? Status::Error : Status::Incomplete;
+        }
+        size_t end = (lf > line_start_ && data[lf - 1] == '\r') ? lf - 1 : lf;
+
+        if (state_ == State::RequestLine) {
+            // stray blank lines before a request are allowed by RFC 7230
+            if (end != line_start_) {
+                if (!parse_request_line(end)) return Status::Error;
+                state_ = State::Headers;
+            }
+        } else if (end == line_start_) {
+            body_.off = static_cast<uint32_t>(lf + 1);
+            state_ = State::Body;
+        } else if (!parse_header_line(end)) {
+            return Status::Error;
+        }
+        line_start_ = scan_pos_ = lf + 1;
+    }
+
+    if (len - body_.off < content_length_) return Status::Incomplete;
+    body_.len = static_cast<uint32_t>(content_length_);
+    return Status::Done;
+}
+
+void HttpParser::reset() {
+    data_ = nullptr;
+    state_ = State::RequestLine;
+    line_start_ = scan_pos_ = 0;
+    method_ = path_ = body_ = Span{};
+    header_count_ = 0;
+    content_length_ = 0;
+    has_content_length_ = false;
+    keep_alive_ = true;
+}
+
+std::string_view HttpParser::header(std::string_view name) const {
+    for (size_t i = 0; i < header_count_; ++i) {
+        if (iequals(view(headers_[i].name), name)) return view(headers_[i].value);
+    }
+    return {};
+}
+
+bool HttpParser::parse_request_line(size_t end) {
+    std::string_view line(data_ + line_start_, end - line_start_);
+    size_t sp1 = line.find(' ');
+    if (sp1 == std::string_view::npos || sp1 == 0) return false;
+    size_t sp2 = line.find(' ', sp1 + 1);
+    if (sp2 == std::string_view::npos || sp2 == sp1 + 1) return false;
+
+    method_ = {static_cast<uint32_t>(line_start_), static_cast<uint32_t>(sp1)};
+    path_ = {static_cast<uint32_t>(line_start_ + sp1 + 1), static_cast<uint32_t>(sp2 - sp1 - 1)};
+
+    // HTTP/1.0 closes unless the client asks for keep-alive
+    keep_alive_ = line.substr(sp2 + 1) != "HTTP/1.0";
+    return true;
+}
+
+bool HttpParser::parse_header_line(size_t end) {
+    std::string_view line(data_ + line_start_, end - line_start_);
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos) return false;
+
+    std::string_view name = trim(line.substr(0, colon));
+    std::string_view value = trim(line.substr(colon + 1));
+    if (name.empty() || header_count_ == kMaxHeaders) return false;
+
+    auto span_of = [this](std::string_view v) {
+        return Span{static_cast<uint32_t>(v.data() - data_), static_cast<uint32_t>(v.size())};
+    };
+    headers_[header_count_++] = {span_of(name), span_of(value)};
+
+    if (iequals(name, "Content-Length")) {
+        if (value.empty()) return false;
+        size_t n = 0;
+        for (char ch : value) {
+            if (ch < '0' || ch > '9') return false;
+            n = n * 10 + static_cast<size_t>(ch - '0');
+            if (n > kMaxBodyBytes) return false;
+        }
+        // two different lengths could frame the body two ways (smuggling
+        // past a proxy that picked the other one)
+        if (has_content_length_ && n != content_length_) return false;
+        content_length_ = n;
+        has_content_length_ = true;
+    } else if (iequals(name, "Connection")) {
+        if (iequals(value, "close")) keep_alive_ = false;
+        else if (iequals(value, "keep-alive")) keep_alive_ = true;
+    } else if (iequals(name, "Transfer-Encoding")) {
+        return false;   // chunked request bodies are not supported
+    }
+    return true;
+}
@@ -1,41 +1,235 @@
 #include "server.h"
+#include <unistd.h>
 #include <iostream>
 #include <csignal>
+#include <sstream>
+#include <charconv>
 
 HTTPServer* g_server = nullptr;
 
+// Only async-signal-safe calls here; the shutdown work runs in main once
+// start() returns.
 void signal_handler(int signal) {
+    static const char msg[] = "\nShutting down...\n";
     if (g_server) {
-        std::cout << "\nShutting down..." << std::endl;
-        g_server->stop();
-        exit(0);
+        if (write(STDOUT_FILENO, msg, sizeof(msg) - 1) < 0) {}
+        g_server->request_stop();
     }
 }
 
+void print_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " <port> [num_threads] [cache_capacity] [db_pool_size] [options]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --binary-port <p>     - also serve the binary protocol on port p" << std::endl;
+    std::cerr << "  --reactors <n>        - listener/epoll loops (SO_REUSEPORT when > 1)" << std::endl;
+    std::cerr << "  --reactor-cores <l>   - pin loops to cores, e.g. 2-5 or 2,4" << std::endl;
+    std::cerr << "  --cache-shards <n>    - independent cache segments (default 16)" << std::endl;
+    std::cerr << "  --cache-engine <e>    - lru (default), clock (lock-free hits) or slab" << std::endl;
+    std::cerr << "  --cache-bytes <n>     - memory budget for the slab engine (default 64MB)" << std::endl;
+    std::cerr << "  --cache-admission <p> - none (default) or tinylfu (lru engine)" << std::endl;
+    std::cerr << "  --storage <s>         - postgres (default) or bitcask (embedded log)" << std::endl;
+    std::cerr << "  --data-dir <path>     - bitcask segment directory (default ./data)" << std::endl;
+    std::cerr << "  --fsync <p>           - bitcask: always, never or every <ms> >= 1 (default 1000)" << std::endl;
+    std::cerr << "  --segment-mb <n>      - bitcask segment size before rolling over (default 64)" << std::endl;
+    std::cerr << "  --compact-ratio <r>   - bitcask: rewrite segments once r (0 < r <= 1) of them is dead (default 0.5)" << std::endl;
+    std::cerr << "  --db-affinity <0|1>   - workers reuse their last pooled connection" << std::endl;
+    std::cerr << "  --db-timeout <ms>     - answer 503 when no pooled connection frees up in time" << std::endl;
+    std::cerr << "  --db-pipeline <n>     - share n connections in libpq pipeline mode" << std::endl;
+    std::cerr << "  --db-async <n>        - n nonblocking connections per reactor" << std::endl;
+    std::cerr << "  --write-behind <ms>   - acknowledge writes from the cache, flush every ms" << std::endl;
+    std::cerr << "  --flush-batch <n>     - max keys per write-behind transaction (default 500)" << std::endl;
+    std::cerr << "  --flush-deadline <ms> - keep retrying the shutdown flush this long (default 30000)" << std::endl;
+    std::cerr << "  --fast-lane <0|1>     - serve cache hits on the reactor thread (default 1)" << std::endl;
+    std::cerr << "  --latency-budget <ms> - shed requests with 503 once queueing would exceed ms" << std::endl;
+    std::cerr << "  --max-queue <n>       - shed new batches while n are waiting for a worker" << std::endl;
+    std::cerr << "  --snapshot <path>     - load the cache from path at startup, save it on shutdown" << std::endl;
+    std::cerr << "  --snapshot-interval <s> - also save the snapshot every s seconds" << std::endl;
+    std::cerr << "  --prewarm-rows <n>    - load up to n rows into the cache before serving" << std::endl;
+    std::cerr << "  --prewarm-prefix <p>  - load the rows whose key starts with p" << std::endl;
+    std::cerr << "  --prewarm-keys <file> - load the keys listed in file, one per line" << std::endl;
+    std::cerr << "  --prewarm-conns <n>   - pooled connections to prewarm over (default 4)" << std::endl;
+}
+
+// The whole of s as a number of out's type; false (out untouched) on
+// anything else, including a sign on an unsigned type or overflow.
+template <typename T>
+bool parse_number(const std::string& s, T& out) {
+    T v{};
+    auto r = std::from_chars(s.data(), s.data() + s.size(), v);
+    if (s.empty() || r.ec != std::errc() || r.ptr != s.data() + s.size()) return false;
+    out = v;
+    return true;
+}
+
+// val must be one of choices
+bool parse_choice(const std::string& val, std::initializer_list<const char*> choices, std::string& out) {
+    for (const char* c : choices) {
+        if (val == c) {
+            out = val;
+            return true;
+        }
+    }
+    return false;
+}
+
+// "0" or "1"
+bool parse_flag(const std::string& val, bool& out) {
+    if (val != "0" && val != "1") return false;
+    out = (val == "1");
+    return true;
+}
+
+// "2-5" or "2,3,7" (same format as the *_CORES entries in config/)
+bool parse_core_list(const std::string& spec, std::vector<int>& cores) {
+    cores.clear();
+    std::stringstream ss(spec);
+    std::string part;
+    while (std::getline(ss, part, ',')) {
+        size_t dash = part.find('-');
+        int lo, hi;
+        if (dash == std::string::npos) {
+            if (!parse_number(part, lo)) return false;
+            hi = lo;
+        } else if (!parse_number(part.substr(0, dash), lo) || !parse_number(part.substr(dash + 1), hi) || lo > hi) {
+            return false;
+        }
+        for (int c = lo; c <= hi; ++c) cores.push_back(c);
+    }
+    return !cores.empty();
+}
+
+// "always", "never" or a sync interval of at least 1 ms
+bool parse_fsync(const std::string& spec, Bitcask::Options& opts) {
+    if (spec == "always") {
+        opts.sync = Bitcask::Sync::Always;
+    } else if (spec == "never") {
+        opts.sync = Bitcask::Sync::Never;
+    } else {
+        size_t ms;
+        if (!parse_number(spec, ms) || ms == 0) return false;
+        opts.sync = Bitcask::Sync::Interval;
+        opts.sync_interval = std::chrono::milliseconds(ms);
+    }
+    return true;
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <port> [num_threads] [cache_capacity]" << std::endl;
+        print_usage(argv[0]);
         return 1;
     }
 
-    int listen_port = atoi(argv[1]);
-    size_t workers_count = (argc > 2) ? static_cast<size_t>(atoi(argv[2])) : 4;
-    size_t cache_limit = (argc > 3) ? static_cast<size_t>(atoi(argv[3])) : 100;
+    ServerConfig config;
+    config.db_conn_string = "host=localhost port=5432 dbname=kv_db user=postgres password=password";
 
+    int pos = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << std::endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+            std::string val = argv[++i];
+            bool ok = true;
+            if (arg == "--reactors")            ok = parse_number(val, config.reactors);
+            else if (arg == "--binary-port")    ok = parse_number(val, config.binary_port);
+            else if (arg == "--reactor-cores")  ok = parse_core_list(val, config.reactor_cores);
+            else if (arg == "--cache-shards")   ok = parse_number(val, config.cache_shards);
+            else if (arg == "--cache-engine")   ok = parse_choice(val, {"lru", "clock", "slab"}, config.cache_engine);
+            else if (arg == "--cache-bytes")    ok = parse_number(val, config.cache_bytes);
+            else if (arg == "--cache-admission") {
+                std::string policy;
+                ok = parse_choice(val, {"none", "tinylfu"}, policy);
+                config.cache_tinylfu = (policy == "tinylfu");
+            }
+            else if (arg == "--storage")        ok = parse_choice(val, {"postgres", "bitcask"}, config.storage);
+            else if (arg == "--data-dir")       config.bitcask.dir = val;
+            else if (arg == "--fsync")          ok = parse_fsync(val, config.bitcask);
+            else if (arg == "--segment-mb") {
+                size_t mb = 0;
+                ok = parse_number(val, mb) && mb > 0 && mb <= (SIZE_MAX >> 20);
+                if (ok) config.bitcask.segment_bytes = mb << 20;
+            }
+            else if (arg == "--compact-ratio") {
+                double r = 0;
+                ok = parse_number(val, r) && r > 0 && r <= 1;
+                if (ok) config.bitcask.compact_ratio = r;
+            }
+            else if (arg == "--db-affinity")    ok = parse_flag(val, config.db_pool_affinity);
+            else if (arg == "--db-timeout")     ok = parse_number(val, config.db_acquire_timeout_ms);
+            else if (arg == "--db-pipeline")    ok = parse_number(val, config.db_pipeline_conns);
+            else if (arg == "--db-async")       ok = parse_number(val, config.db_async_conns);
+            else if (arg == "--write-behind")   ok = parse_number(val, config.write_behind_ms);
+            else if (arg == "--flush-batch")    ok = parse_number(val, config.write_behind_batch);
+            else if (arg == "--flush-deadline") ok = parse_number(val, config.write_behind_drain_ms);
+            else if (arg == "--fast-lane")      ok = parse_flag(val, config.fast_lane);
+            else if (arg == "--latency-budget") ok = parse_number(val, config.latency_budget_ms);
+            else if (arg == "--max-queue")      ok = parse_number(val, config.max_pending);
+            else if (arg == "--snapshot")       config.snapshot_path = val;
+            else if (arg == "--snapshot-interval") ok = parse_number(val, config.snapshot_interval_s);
+            else if (arg == "--prewarm-rows")   ok = parse_number(val, config.prewarm_rows);
+            else if (arg == "--prewarm-prefix") config.prewarm_prefix = val;
+            else if (arg == "--prewarm-keys")   config.prewarm_keys_file = val;
+            else if (arg == "--prewarm-conns")  ok = parse_number(val, config.prewarm_conns);
+            else {
+                std::cerr << "Unknown option " << arg << std::endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+            if (!ok) {
+                std::cerr << "Invalid value for " << arg << ": " << val << std::endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+            continue;
+        }
+        bool ok = true;
+        switch (pos++) {
+            case 0: ok = parse_number(arg, config.port); break;
+            case 1: ok = parse_number(arg, config.num_threads); break;
+            case 2: ok = parse_number(arg, config.cache_capacity); break;
+            case 3: ok = parse_number(arg, config.db_pool_size); break;
+        }
+        if (!ok) {
+            std::cerr << "Invalid argument " << arg << std::endl;
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
 
-    std::string db_conn = "host=localhost port=5432 dbname=kv_db user=postgres password=password";
-    
     std::signal(SIGINT, signal_handler);
-    
-    HTTPServer server(listen_port, workers_count, cache_limit, db_conn);
+
+    HTTPServer server(config);
     g_server = &server;
-    
+
     std::cout << "Starting KV Server..." << std::endl;
-    std::cout << "Port: " << listen_port << std::endl;
-    std::cout << "Threads: " << workers_count << std::endl;
-    std::cout << "Cache Capacity: " << cache_limit << std::endl;
-    
+    std::cout << "Port: " << config.port;
+    if (config.binary_port)
+        std::cout << " (binary " << config.binary_port << ")";
+    std::cout << std::endl;
+    std::cout << "Threads: " << config.num_threads << std::endl;
+    std::cout << "Cache Capacity: " << config.cache_capacity
+              << " (" << config.cache_engine << ", " << config.cache_shards << " shards)" << std::endl;
+    std::cout << "Storage: " << config.storage;
+    if (config.storage == "bitcask")
+        std::cout << " (" << config.bitcask.dir << ")";
+    std::cout << std::endl;
+    std::cout << "DB Pool: " << config.db_pool_size;
+    if (config.db_pipeline_conns)
+        std::cout << " (+" << config.db_pipeline_conns << " pipelined)";
+    std::cout << std::endl;
+    std::cout << "Reactors: " << config.reactors << std::endl;
+    if (!config.snapshot_path.empty()) {
+        std::cout << "Snapshot: " << config.snapshot_path;
+        if (config.snapshot_interval_s)
+            std::cout << " (every " << config.snapshot_interval_s << "s)";
+        std::cout << std::endl;
+    }
+
     server.start();
-    
+    server.stop();
+
     return 0;
 }
@@ -0,0 +1,505 @@
+#include "reactor.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+
+namespace {
+
+constexpr int kIdleTimeoutSec = 30;   // same keep-alive limit the blocking loop had
+constexpr int kSendTimeoutSec = 30;   // a client that stops reading its responses
+constexpr int kMaxEvents = 256;
+constexpr int kReadsPerEvent = 4;
+constexpr int kMaxIov = 256;   // a full pipelined batch is 3 pieces per response
+
+constexpr size_t kInitialBuffer = 4096;
+constexpr size_t kMinReadSpace = 1024;
+
+const char kBadRequest[] =
+    "HTTP/1.1 400 Bad Request\r\nConnection: close\r\nContent-Length: 11\r\n\r\nBAD_REQUEST";
+
+} // namespace
+
+Reactor::Reactor(int listen_fd, RequestHandler handler)
+    : listen_fd_(listen_fd), handler_(std::move(handler))
+{
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ < 0 || wake_fd_ < 0) {
+        std::cerr << "Reactor: failed to create epoll/eventfd\n";
+        return;
+    }
+
+    int flags = fcntl(listen_fd_, F_GETFL, 0);
+    fcntl(listen_fd_, F_SETFL, flags | O_NONBLOCK);
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev);
+    ev.data.fd = wake_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+}
+
+Reactor::~Reactor() {
+    for (auto& kv : conns_) close(kv.first);
+    if (epoll_fd_ >= 0) close(epoll_fd_);
+    if (wake_fd_ >= 0) close(wake_fd_);
+}
+
+void Reactor::listen_binary(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) == 0) binary_fd_ = fd;
+}
+
+void Reactor::run() {
+    epoll_event events[kMaxEvents];
+    auto last_sweep = std::chrono::steady_clock::now();
+
+    while (running_) {
+        int n = epoll_wait(epoll_fd_, events, kMaxEvents, 1000);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "epoll_wait failed\n";
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            uint32_t ev = events[i].events;
+
+            if (fd == listen_fd_ || fd == binary_fd_) {
+                accept_ready(fd);
+                continue;
+            }
+            if (fd == wake_fd_) {
+                uint64_t v;
+                while (read(wake_fd_, &v, sizeof(v)) > 0) {}
+                drain_completions();
+                continue;
+            }
+
+            auto w = watchers_.find(fd);
+            if (w != watchers_.end()) {
+                FdHandler h = w->second;   // the handler may unwatch itself
+                h(ev);
+                continue;
+            }
+
+            auto it = conns_.find(fd);
+            if (it == conns_.end()) continue;
+            Connection& c = *it->second;
+
+            if (ev & (EPOLLERR | EPOLLHUP)) {
+                close_conn(fd);
+                continue;
+            }
+            if (ev & EPOLLOUT) {
+                settle(c);
+            } else if (ev & EPOLLIN) {
+                read_ready(c);
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_sweep >= std::chrono::seconds(1)) {
+            sweep_idle();
+            last_sweep = now;
+        }
+    }
+
+    // Drop every client, and refuse send_partial() from here on, so a
+    // streaming worker waiting on on_drained learns its client is gone and
+    // lets go of what it holds before the worker pool is drained.
+    std::vector<Completion> left;
+    {
+        std::lock_guard<std::mutex> lock(done_mutex_);
+        stopped_ = true;
+        left.swap(done_);
+    }
+    for (auto& d : left) {
+        if (d.on_drained) d.on_drained(false);
+    }
+    while (!conns_.empty()) close_conn(conns_.begin()->first);
+}
+
+void Reactor::stop() {
+    running_ = false;
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0) {}
+}
+
+void Reactor::complete(const ConnHandle& conn, std::vector<HttpResponse> responses, bool keep_alive) {
+    bool was_empty;
+    {
+        std::lock_guard<std::mutex> lock(done_mutex_);
+        was_empty = done_.empty() && posted_.empty();
+        done_.push_back({conn, std::move(responses), keep_alive});
+    }
+    if (was_empty) {
+        uint64_t one = 1;
+        if (write(wake_fd_, &one, sizeof(one)) < 0) {}
+    }
+}
+
+void Reactor::send_partial(const ConnHandle& conn, std::vector<HttpResponse> responses,
+                           DrainHandler on_drained) {
+    bool was_empty, stopped;
+    {
+        std::lock_guard<std::mutex> lock(done_mutex_);
+        stopped = stopped_;
+        was_empty = done_.empty() && posted_.empty();
+        if (!stopped) done_.push_back({conn, std::move(responses), true, std::move(on_drained)});
+    }
+    if (stopped) {
+        on_drained(false);
+        return;
+    }
+    if (was_empty) {
+        uint64_t one = 1;
+        if (write(wake_fd_, &one, sizeof(one)) < 0) {}
+    }
+}
+
+void Reactor::post(std::function<void()> task) {
+    bool was_empty;
+    {
+        std::lock_guard<std::mutex> lock(done_mutex_);
+        was_empty = done_.empty() && posted_.empty();
+        posted_.push_back(std::move(task));
+    }
+    if (was_empty) {
+        uint64_t one = 1;
+        if (write(wake_fd_, &one, sizeof(one)) < 0) {}
+    }
+}
+
+void Reactor::watch(int fd, uint32_t events, FdHandler handler) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) return;
+    watchers_[fd] = std::move(handler);
+}
+
+void Reactor::rewatch(int fd, uint32_t events) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void Reactor::unwatch(int fd) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    watchers_.erase(fd);
+}
+
+void Reactor::accept_ready(int listen_fd) {
+    while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK && running_)
+                std::cerr << "Accept failed\n";
+            return;
+        }
+
+        // responses go out in whole batches; Nagle would only hold back the
+        // tail of a pipeline that spans more than one batch
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        auto c = std::make_unique<Connection>();
+        c->fd = fd;
+        c->id = next_id_++;
+        c->binary = listen_fd == binary_fd_;
+        c->events = EPOLLIN;
+        c->last_active = std::chrono::steady_clock::now();
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            continue;
+        }
+        conns_[fd] = std::move(c);
+        open_conns_++;
+    }
+}
+
+void Reactor::read_ready(Connection& c) {
+    // the buffer is frozen while a worker holds views into it
+    if (c.busy) return;
+
+    for (int i = 0; i < kReadsPerEvent; ++i) {
+        char* dst = c.in.reserve(kMinReadSpace);
+        size_t space = c.in.cap - c.in.len;
+        ssize_t n = recv(c.fd, dst, space, 0);
+        if (n > 0) {
+            c.in.len += static_cast<size_t>(n);
+            if (static_cast<size_t>(n) < space) break;
+            continue;
+        }
+        if (n == 0) {
+            c.peer_closed = true;
+            break;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        close_conn(c.fd);
+        return;
+    }
+    c.last_active = std::chrono::steady_clock::now();
+    settle(c);
+}
+
+void Reactor::drain_completions() {
+    std::vector<Completion> batch;
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(done_mutex_);
+        batch.swap(done_);
+        tasks.swap(posted_);
+    }
+    for (auto& task : tasks) task();
+
+    for (auto& d : batch) {
+        auto it = conns_.find(d.conn.fd);
+        if (it == conns_.end() || it->second->id != d.conn.id) {
+            // client went away
+            if (d.on_drained) d.on_drained(false);
+            else closing_.erase(d.conn.id);
+            continue;
+        }
+        Connection& c = *it->second;
+
+        if (d.on_drained) {
+            for (auto& r : d.responses) c.out.push_back(std::move(r));
+            c.on_drained = std::move(d.on_drained);
+            c.last_active = std::chrono::steady_clock::now();
+            settle(c);
+            continue;
+        }
+
+        c.busy = false;
+        c.in.consume(c.in_flight);
+        c.in_flight = 0;
+        for (auto& r : d.responses) c.out.push_back(std::move(r));
+        if (!d.keep_alive) c.close_after_write = true;
+        c.last_active = std::chrono::steady_clock::now();
+        settle(c);
+    }
+}
+
+// Writes queued responses with one sendmsg per batch of pieces; cached
+// values go out from their shared buffers without being copied.
+bool Reactor::flush(Connection& c) {
+    while (!c.out.empty()) {
+        iovec iov[kMaxIov];
+        int n = 0;
+        size_t skip = c.out_off;
+        for (const HttpResponse& r : c.out) {
+            const std::string* pieces[3] = {&r.head, r.value.get(), &r.tail};
+            for (const std::string* p : pieces) {
+                if (!p || p->size() <= skip) {
+                    skip -= p ? p->size() : 0;
+                    continue;
+                }
+                iov[n].iov_base = const_cast<char*>(p->data() + skip);
+                iov[n].iov_len = p->size() - skip;
+                skip = 0;
+                if (++n == kMaxIov) break;
+            }
+            if (n == kMaxIov) break;
+        }
+
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        ssize_t sent = sendmsg(c.fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            close_conn(c.fd);
+            return false;
+        }
+
+        c.out_off += static_cast<size_t>(sent);
+        c.last_active = std::chrono::steady_clock::now();
+        while (!c.out.empty() && c.out_off >= c.out.front().size()) {
+            c.out_off -= c.out.front().size();
+            c.out.pop_front();
+        }
+    }
+    c.out_off = 0;
+    return true;
+}
+
+// Parses every complete request in the buffer and hands them over as one
+// batch. A partial request at the end stays in the parser, which resumes
+// at the same offsets once the batch is consumed from the buffer front.
+void Reactor::dispatch(Connection& c) {
+    if (c.busy || c.close_after_write || c.in.len == 0) return;
+
+    RequestBatch batch;
+    size_t off = 0;
+    if (c.binary && !parse_binary(c, batch, off)) {
+        c.out.push_back({binproto::response_head(binproto::kBadRequest, 0), nullptr, {}});
+        c.close_after_write = true;
+        return;
+    }
+    while (!c.binary && batch.size() < kMaxPipeline && off < c.in.len) {
+        HttpParser::Status st = c.parser.parse(c.in.data.get() + off, c.in.len - off);
+        if (st == HttpParser::Status::Incomplete) break;
+        if (st == HttpParser::Status::Error) {
+            if (!batch.empty()) {
+                // answer what parsed cleanly; the error surfaces next round
+                c.parser.reset();
+                break;
+            }
+            c.out.push_back({kBadRequest, nullptr, {}});
+            c.close_after_write = true;
+            return;
+        }
+
+        HttpRequest req;
+        req.method = c.parser.method();
+        req.path = c.parser.path();
+        req.body = c.parser.body();
+        req.keep_alive = c.parser.keep_alive();
+        off += c.parser.consumed();
+        c.parser.reset();
+        batch.push_back(req);
+        if (!req.keep_alive) break;   // nothing after a close is answered
+    }
+    if (batch.empty()) return;
+
+    if (c.peer_closed && off == c.in.len) batch.back().keep_alive = false;
+    c.in_flight = off;
+    c.busy = true;
+    handler_({this, c.fd, c.id}, std::move(batch));
+}
+
+// Binary counterpart of the HTTP loop in dispatch(): frames carry their
+// own lengths, so there is no parser state to keep between calls. False on
+// a malformed frame with nothing before it; one after good frames is left
+// for the next round, like an HTTP parse error.
+bool Reactor::parse_binary(Connection& c, RequestBatch& batch, size_t& off) {
+    while (batch.size() < kMaxPipeline && off < c.in.len) {
+        binproto::Frame f;
+        binproto::ParseStatus st = binproto::parse(c.in.data.get() + off, c.in.len - off, f);
+        if (st == binproto::ParseStatus::Incomplete) break;
+        if (st == binproto::ParseStatus::Error) return !batch.empty();
+
+        HttpRequest req;
+        req.method = binproto::method(f.op);
+        req.path = f.key;
+        req.body = f.body;
+        req.binary = true;
+        off += f.size;
+        batch.push_back(req);
+    }
+    return true;
+}
+
+// After any progress on a connection: push pending output, hand the next
+// buffered request to a worker, close when finished, and re-arm epoll.
+void Reactor::settle(Connection& c) {
+    if (!flush(c)) return;
+    if (c.out.empty() && c.on_drained) notify_drained(c, true);
+    if (c.out.empty()) dispatch(c);
+
+    bool idle = !c.busy && c.out.empty();
+    if (idle && (c.close_after_write || c.peer_closed)) {
+        close_conn(c.fd);
+        return;
+    }
+    update_interest(c);
+}
+
+void Reactor::update_interest(Connection& c) {
+    uint32_t want = 0;
+    if (!c.out.empty()) want = EPOLLOUT;
+    else if (!c.busy && !c.peer_closed) want = EPOLLIN;
+    if (want == c.events) return;
+
+    epoll_event ev{};
+    ev.events = want;
+    ev.data.fd = c.fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, c.fd, &ev);
+    c.events = want;
+}
+
+void Reactor::close_conn(int fd) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    open_conns_--;
+
+    auto it = conns_.find(fd);
+    if (it == conns_.end()) return;
+    std::unique_ptr<Connection> c = std::move(it->second);
+    conns_.erase(it);
+    if (c->on_drained) notify_drained(*c, false);
+    if (c->busy) closing_[c->id] = std::move(c);
+}
+
+void Reactor::notify_drained(Connection& c, bool alive) {
+    DrainHandler h = std::move(c.on_drained);
+    c.on_drained = nullptr;
+    h(alive);
+}
+
+// Closes keep-alive connections left idle, and connections whose output
+// has made no progress for kSendTimeoutSec. The latter may be a streaming
+// worker waiting on on_drained; closing tells it the client is gone, so it
+// releases whatever it holds (a scan's cursor and pooled connection).
+void Reactor::sweep_idle() {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<int> expired;
+    for (auto& kv : conns_) {
+        const Connection& c = *kv.second;
+        if (!c.busy && c.out.empty() &&
+            now - c.last_active > std::chrono::seconds(kIdleTimeoutSec)) {
+            expired.push_back(kv.first);
+        } else if (!c.out.empty() &&
+                   now - c.last_active > std::chrono::seconds(kSendTimeoutSec)) {
+            expired.push_back(kv.first);
+        }
+    }
+    for (int fd : expired) close_conn(fd);
+}
+
+char* Reactor::InputBuffer::reserve(size_t n) {
+    if (cap - len < n) {
+        size_t grown = std::max(cap ? cap * 2 : kInitialBuffer, len + n);
+        std::unique_ptr<char[]> bigger(new char[grown]);
+        if (len) std::memcpy(bigger.get(), data.get(), len);
+        data = std::move(bigger);
+        cap = grown;
+    }
+    return data.get() + len;
+}
+
+void Reactor::InputBuffer::consume(size_t n) {
+    if (n >= len) {
+        len = 0;
+        return;
+    }
+    std::memmove(data.get(), data.get() + n, len - n);
+    len -= n;
+}
@@ -1,284 +1,1554 @@
 #include "server.h"
+#include "cache_snapshot.h"
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <fstream>
+#include <cctype>
+#include <cerrno>
 #include <cstring>
+#include <limits>
+#include <unordered_map>
 
-HTTPServer::HTTPServer(int port, size_t num_threads, size_t cache_capacity,
-                       const std::string &db_conn_string, size_t db_pool_size)
-    : listen_port_(port), listen_fd_(-1)
+namespace
 {
-    thread_pool_ = std::make_unique<ThreadPool>(num_threads);
-    cache_       = std::make_unique<LRUCache>(cache_capacity);
-    db_pool_     = std::make_unique<DBConnectionPool>(db_conn_string, db_pool_size);
+const char *const kOK = "HTTP/1.1 200 OK";
+const char *const kBadRequest = "HTTP/1.1 400 Bad Request";
+const char *const kNotFound = "HTTP/1.1 404 Not Found";
+const char *const kServerError = "HTTP/1.1 500 Internal Server Error";
+const char *const kServiceUnavailable = "HTTP/1.1 503 Service Unavailable";
+const char *const kRetryAfter = "Retry-After: 1\r\n";
+
+// most keys one _mget or _mput may carry
+constexpr size_t kMaxMultiKeys = 1000;
+
+// keys per COPY when prewarming from a key list
+constexpr size_t kPrewarmChunk = 1000;
+
+// how long a snapshot waits for the writes already running to finish
+constexpr std::chrono::seconds kSnapshotDrain{2};
+
+// _mget body: one key per line.
+bool parse_key_list(std::string_view body, std::vector<std::string> &keys)
+{
+    while (!body.empty())
+    {
+        size_t nl = body.find('\n');
+        std::string_view key = body.substr(0, nl);
+        if (!key.empty() && key.back() == '\r')
+            key.remove_suffix(1);
+        if (!key.empty())
+            keys.emplace_back(key);
+        body.remove_prefix(nl == std::string_view::npos ? body.size() : nl + 1);
+    }
+    return !keys.empty() && keys.size() <= kMaxMultiKeys;
 }
 
-HTTPServer::~HTTPServer()
+// Decimal length followed by the given terminator, consumed from in.
+bool parse_length(std::string_view &in, char end, size_t &n)
 {
-    stop();
+    size_t i = 0;
+    n = 0;
+    for (; i < in.size() && in[i] >= '0' && in[i] <= '9'; ++i)
+    {
+        n = n * 10 + static_cast<size_t>(in[i] - '0');
+        if (n > (1u << 30))
+            return false;
+    }
+    if (i == 0 || i == in.size() || in[i] != end)
+        return false;
+    in.remove_prefix(i + 1);
+    return true;
 }
 
-void HTTPServer::start()
+// _mput body: "<key-len> <value-len>\n<key><value>" per entry. A key given
+// twice keeps its last value, as the upsert can touch each row only once.
+bool parse_records(std::string_view body, std::vector<std::string> &keys, std::vector<CacheValue> &values)
 {
-    if (!db_pool_->is_connected()) {
-        std::cerr << "Failed to connect to database pool\n";
-        return;
+    std::unordered_map<std::string, size_t> seen;
+    while (!body.empty())
+    {
+        size_t klen, vlen;
+        if (!parse_length(body, ' ', klen) || !parse_length(body, '\n', vlen) ||
+            klen == 0 || body.size() < klen + vlen)
+            return false;
+        std::string key(body.substr(0, klen));
+        auto value = std::make_shared<const std::string>(body.substr(klen, vlen));
+        body.remove_prefix(klen + vlen);
+
+        auto [it, fresh] = seen.emplace(key, keys.size());
+        if (fresh)
+        {
+            keys.push_back(std::move(key));
+            values.push_back(std::move(value));
+        }
+        else
+        {
+            values[it->second] = std::move(value);
+        }
+        if (keys.size() > kMaxMultiKeys)
+            return false;
+    }
+    return !keys.empty();
+}
+
+// _mget response: "<len>\n<value>\n" per requested key, in order, or
+// "-1\n" for a key that does not exist.
+std::string mget_body(const std::vector<CacheValue> &values)
+{
+    size_t total = 0;
+    for (const auto &v : values)
+        total += 16 + (v ? v->size() : 0);
+    std::string out;
+    out.reserve(total);
+    for (const auto &v : values)
+    {
+        if (!v)
+        {
+            out += "-1\n";
+            continue;
+        }
+        out += std::to_string(v->size());
+        out += '\n';
+        out += *v;
+        out += '\n';
+    }
+    return out;
+}
+
+// rows fetched from a scan cursor per chunk; also bounds what a scan keeps
+// in memory at once
+constexpr size_t kScanChunkRows = 256;
+// Postgres takes a scan's limit as an int8
+constexpr size_t kMaxScanLimit = std::numeric_limits<int64_t>::max();
+
+int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Percent-decoded value of name in a query string, empty if absent.
+std::string query_param(std::string_view query, std::string_view name)
+{
+    while (!query.empty())
+    {
+        size_t amp = query.find('&');
+        std::string_view pair = query.substr(0, amp);
+        query.remove_prefix(amp == std::string_view::npos ? query.size() : amp + 1);
+        size_t eq = pair.find('=');
+        if (pair.substr(0, eq) != name || eq == std::string_view::npos)
+            continue;
+
+        std::string out;
+        std::string_view v = pair.substr(eq + 1);
+        for (size_t i = 0; i < v.size(); ++i)
+        {
+            if (v[i] == '%' && i + 2 < v.size() && hex_digit(v[i + 1]) >= 0 && hex_digit(v[i + 2]) >= 0)
+            {
+                out += static_cast<char>(hex_digit(v[i + 1]) * 16 + hex_digit(v[i + 2]));
+                i += 2;
+            }
+            else
+            {
+                out += v[i] == '+' ? ' ' : v[i];
+            }
+        }
+        return out;
+    }
+    return {};
+}
+
+// Scan rows in the _mput framing, "<key-len> <value-len>\n<key><value>",
+// wrapped as one HTTP chunk.
+std::string scan_chunk(const std::vector<Storage::Row> &rows)
+{
+    std::string body;
+    for (const auto &r : rows)
+    {
+        body += std::to_string(r.first.size()) + " " + std::to_string(r.second.size()) + "\n";
+        body += r.first;
+        body += r.second;
     }
+    char size[32];
+    snprintf(size, sizeof(size), "%zx\r\n", body.size());
+    return size + body + "\r\n";
+}
+
+// Resident set size of the process, from /proc/self/statm.
+size_t resident_bytes()
+{
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+// body = prefix + *value + suffix; value is a shared cache buffer
+HttpResponse make_response(const HttpRequest &req, const char *status, const char *headers,
+                           std::string prefix, CacheValue value = nullptr, const char *suffix = "")
+{
+    std::string connection_header = req.keep_alive ? "keep-alive" : "close";
+    std::string tail = suffix;
+    size_t content_length = prefix.size() + (value ? value->size() : 0) + tail.size();
+
+    HttpResponse resp;
+    resp.head = std::string(status) + "\r\n" +
+                headers +
+                "Connection: " + connection_header + "\r\n" +
+                "Content-Length: " + std::to_string(content_length) + "\r\n" +
+                "\r\n" + prefix;
+    resp.value = std::move(value);
+    resp.tail = std::move(tail);
+    return resp;
+}
+
+// binproto answer: status, then body + *value
+HttpResponse binary_response(uint8_t status, std::string body = {}, CacheValue value = nullptr)
+{
+    HttpResponse resp;
+    resp.head = binproto::response_head(status, body.size() + (value ? value->size() : 0)) + body;
+    resp.value = std::move(value);
+    return resp;
+}
+
+// Replies shared by both protocols.
+HttpResponse ok_response(const HttpRequest &req)
+{
+    return req.binary ? binary_response(binproto::kOk) : make_response(req, kOK, "", "OK");
+}
 
-    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd_ < 0)
+HttpResponse bad_request(const HttpRequest &req)
+{
+    return req.binary ? binary_response(binproto::kBadRequest)
+                      : make_response(req, kBadRequest, "", "BAD_REQUEST");
+}
+
+HttpResponse hit_response(const HttpRequest &req, CacheValue value)
+{
+    if (req.binary)
+        return binary_response(binproto::kOk | binproto::kCached, {}, std::move(value));
+    return make_response(req, kOK, "X-Cache-Status: HIT\r\n", "VALUE:", std::move(value), ":END");
+}
+
+HttpResponse not_found_response(const HttpRequest &req)
+{
+    return req.binary ? binary_response(binproto::kNotFound)
+                      : make_response(req, kNotFound, "X-Cache-Status: MISS\r\n", "NOT_FOUND");
+}
+
+// binproto MGET answer body: value_len:u32 value per key, kNil if absent.
+std::string binary_mget_body(const std::vector<CacheValue> &values)
+{
+    size_t total = 0;
+    for (const auto &v : values)
+        total += 4 + (v ? v->size() : 0);
+    std::string out;
+    out.reserve(total);
+    for (const auto &v : values)
+    {
+        binproto::append_u32(out, v ? static_cast<uint32_t>(v->size()) : binproto::kNil);
+        if (v)
+            out += *v;
+    }
+    return out;
+}
+} // namespace
+
+HTTPServer::HTTPServer(const ServerConfig &config)
+    : config_(config), listen_port_(config.port),
+      db_timeout_(config.db_acquire_timeout_ms),
+      latency_budget_(config.latency_budget_ms)
+{
+    stop_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    thread_pool_ = std::make_unique<ThreadPool>(config.num_threads);
+    if (config.cache_engine == "clock")
+        cache_   = std::make_unique<ClockCache>(config.cache_capacity, config.cache_shards);
+    else if (config.cache_engine == "slab")
+        cache_   = std::make_unique<SlabCache>(config.cache_bytes, config.cache_shards);
+    else
+        cache_   = std::make_unique<ShardedLRUCache>(config.cache_capacity, config.cache_shards,
+                                                     config.cache_tinylfu);
+
+    // every pooled session (and the write-behind flusher's) comes from here
+    DBConnectionPool::Opener open_store;
+    if (config.storage == "bitcask")
+    {
+        bitcask_ = std::make_unique<Bitcask>(config.bitcask);
+        open_store = [this] { return std::make_unique<BitcaskStore>(*bitcask_); };
+    }
+    else
+    {
+        // DDL once, here, rather than racing itself on every session
+        if (!Database::create_schema(config.db_conn_string))
+            std::cerr << "Failed to create or migrate kv_store\n";
+        open_store = [conninfo = config.db_conn_string] { return std::make_unique<Database>(conninfo); };
+    }
+    db_pool_     = std::make_unique<DBConnectionPool>(open_store, config.db_pool_size,
+                                                      config.db_pool_affinity);
+    if (config.db_pipeline_conns > 0 && !bitcask_)
+        db_pipeline_ = std::make_unique<DBPipeline>(config.db_conn_string, config.db_pipeline_conns);
+    if (config.write_behind_ms > 0)
+        write_behind_ = std::make_unique<WriteBehind>(open_store(),
+                                                      std::chrono::milliseconds(config.write_behind_ms),
+                                                      config.write_behind_batch,
+                                                      std::chrono::milliseconds(config.write_behind_drain_ms));
+}
+
+HTTPServer::~HTTPServer()
+{
+    stop();
+    if (stop_fd_ >= 0)
+        close(stop_fd_);
+}
+
+int HTTPServer::open_listener(int port, bool reuse_port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
     {
         std::cerr << "Failed to create socket\n";
-        return;
+        return -1;
     }
 
     int opt = 1;
-    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    {
+        std::cerr << "Failed to set SO_REUSEPORT\n";
+        close(fd);
+        return -1;
+    }
 
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
-    addr.sin_port = htons(listen_port_);
+    addr.sin_port = htons(port);
     addr.sin_addr.s_addr = INADDR_ANY;
 
-    if (bind(listen_fd_, (sockaddr *)&addr, sizeof(addr)) < 0)
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0)
     {
         std::cerr << "Failed to bind\n";
-        close(listen_fd_);
-        return;
+        close(fd);
+        return -1;
     }
 
-    if (listen(listen_fd_, 128) < 0)
+    if (listen(fd, SOMAXCONN) < 0)
     {
         std::cerr << "Failed to listen\n";
-        close(listen_fd_);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void HTTPServer::start()
+{
+    if (bitcask_ && (config_.db_pipeline_conns > 0 || config_.db_async_conns > 0))
+    {
+        std::cerr << "--db-pipeline and --db-async need --storage postgres\n";
         return;
     }
+    if (!db_pool_->is_connected() || (db_pipeline_ && !db_pipeline_->is_connected()) ||
+        (write_behind_ && !write_behind_->is_connected())) {
+        std::cerr << "Failed to connect to database pool\n";
+        return;
+    }
+    if (config_.prewarm_rows || !config_.prewarm_prefix.empty() || !config_.prewarm_keys_file.empty())
+        prewarm();
+    if (!config_.snapshot_path.empty())
+        load_snapshot();
+
+    size_t loops = std::max<size_t>(1, config_.reactors);
+    for (size_t i = 0; i < loops; ++i)
+    {
+        int fd = open_listener(listen_port_, loops > 1);
+        if (fd < 0)
+        {
+            stop();
+            return;
+        }
+        listen_fds_.push_back(fd);
+        reactors_.push_back(std::make_unique<Reactor>(fd,
+            [this](const ConnHandle &conn, Reactor::RequestBatch batch) { on_request(conn, std::move(batch)); }));
+
+        if (config_.binary_port > 0)
+        {
+            int bfd = open_listener(config_.binary_port, loops > 1);
+            if (bfd < 0)
+            {
+                stop();
+                return;
+            }
+            listen_fds_.push_back(bfd);
+            reactors_.back()->listen_binary(bfd);
+        }
+
+        if (config_.db_async_conns > 0)
+        {
+            async_dbs_.emplace_back();
+            for (size_t c = 0; c < config_.db_async_conns; ++c)
+            {
+                auto db = std::make_unique<AsyncDatabase>(config_.db_conn_string);
+                if (!db->connect())
+                {
+                    std::cerr << "Failed to open async DB connection\n";
+                    stop();
+                    return;
+                }
+                db->attach(*reactors_.back());
+                async_dbs_.back().push_back(std::move(db));
+            }
+        }
+    }
+
+    // level-triggered, so a stop requested before the loop runs still counts
+    reactors_[0]->watch(stop_fd_, EPOLLIN, [this](uint32_t)
+                        {
+                            for (auto &r : reactors_)
+                                r->stop();
+                        });
 
     running_ = true;
-    std::cout << "Server started on port " << listen_port_ << std::endl;
+    if (!config_.snapshot_path.empty() && config_.snapshot_interval_s > 0)
+    {
+        // the cache runs ahead of the store until a flush, so only the
+        // snapshot taken after the final one at shutdown is consistent
+        if (write_behind_)
+            std::cerr << "--snapshot-interval is ignored with --write-behind\n";
+        else
+            snapshot_thread_ = std::thread(&HTTPServer::snapshot_loop, this);
+    }
+    std::cout << "Server started on port " << listen_port_;
+    if (config_.binary_port > 0)
+        std::cout << ", binary protocol on " << config_.binary_port;
+    std::cout << " (" << loops << " reactor" << (loops > 1 ? "s" : "") << ")" << std::endl;
 
-    accept_loop();
+    // loop 0 runs on the calling thread, the rest get their own
+    for (size_t i = 1; i < loops; ++i)
+    {
+        reactor_threads_.emplace_back(&HTTPServer::run_reactor, this, i);
+    }
+    run_reactor(0);
+
+    for (auto &t : reactor_threads_)
+    {
+        if (t.joinable())
+            t.join();
+    }
 }
 
-void HTTPServer::accept_loop()
+void HTTPServer::run_reactor(size_t index)
 {
-    while (running_)
+    if (!config_.reactor_cores.empty())
     {
-        int client_fd = accept(listen_fd_, nullptr, nullptr);
-        if (client_fd < 0)
+        int core = config_.reactor_cores[index % config_.reactor_cores.size()];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
         {
-            if (running_)
-                std::cerr << "Accept failed\n";
-            continue;
+            std::cerr << "Reactor " << index << ": failed to pin to core " << core << "\n";
         }
+    }
+    reactors_[index]->run();
+}
 
-        thread_pool_->enqueue([this, client_fd]()
-                              { handle_client(client_fd); });
+// Called on the reactor thread with the fully read requests of one
+// connection. Leading requests the cache can answer are served right here;
+// the rest run in order on a single worker, so a pipelined PUT is visible
+// to the GET behind it. The request views stay valid until complete()
+// hands the responses back.
+void HTTPServer::on_request(const ConnHandle &conn, Reactor::RequestBatch batch)
+{
+    auto *st = new BatchState;
+    st->conn = conn;
+    st->batch = std::move(batch);
+    st->responses.reserve(st->batch.size());
+    if (config_.fast_lane && run_fast_lane(st))
+        return;
+    if (config_.max_pending && slow_lane_pending_.load(std::memory_order_relaxed) >= config_.max_pending)
+    {
+        shed_queue_full_.fetch_add(1, std::memory_order_relaxed);
+        shed(st);
+        return;
     }
+    slow_lane_pending_.fetch_add(1, std::memory_order_relaxed);
+    st->handed_off = std::chrono::steady_clock::now();
+    thread_pool_->enqueue([this, st]()
+    {
+        slow_lane_pending_.fetch_sub(1, std::memory_order_relaxed);
+        auto waited = std::chrono::steady_clock::now() - st->handed_off;
+        slow_lane_wait_.record(std::chrono::duration_cast<std::chrono::microseconds>(waited).count());
+        if (latency_budget_.count() && waited >= latency_budget_)
+        {
+            shed_deadline_.fetch_add(1, std::memory_order_relaxed);
+            shed(st);
+            return;
+        }
+        run_batch(st);
+    });
 }
 
-void HTTPServer::handle_client(int client_fd)
+// Fast lane: answers requests from the cache on the reactor thread until
+// one needs more. Writes stop it before begin_request(), because a
+// write-behind PUT can block on backpressure; a miss stops it with the
+// statement already prepared for the worker. True if nothing was left.
+bool HTTPServer::run_fast_lane(BatchState *st)
 {
-    struct timeval timeout = {30, 0}; // 30 second timeout for keep-alive
-    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    
-    bool keep_alive = true;
-    
-    while (keep_alive && running_)
+    while (st->next() < st->batch.size())
     {
-        std::string request;
-        char buffer[8192];
-        ssize_t bytes;
-        bool headers_complete = false;
-        size_t content_length = 0;
-        size_t header_end_pos = 0;
+        const HttpRequest &req = st->batch[st->next()];
+        if (req.method == "PUT" || req.method == "DELETE" || (!req.binary && req.path == "/_mput"))
+            return false;
 
-        // Read request headers
-        while ((bytes = recv(client_fd, buffer, sizeof(buffer), 0)) > 0)
+        auto start = std::chrono::steady_clock::now();
+        HttpResponse resp;
+        st->db = DBRequest{};
+        if (!begin_request(req, st->db, resp))
         {
-            request.append(buffer, bytes);
-            
-            // Check if headers are complete
-            header_end_pos = request.find("\r\n\r\n");
-            if (header_end_pos != std::string::npos) {
-                headers_complete = true;
-                
-                // Extract Content-Length if present
-                size_t cl_pos = request.find("Content-Length:");
-                if (cl_pos != std::string::npos && cl_pos < header_end_pos) {
-                    size_t cl_start = cl_pos + 15;
-                    size_t cl_end = request.find("\r\n", cl_start);
-                    std::string cl_str = request.substr(cl_start, cl_end - cl_start);
-                    // Trim whitespace
-                    cl_str.erase(0, cl_str.find_first_not_of(" \t"));
-                    cl_str.erase(cl_str.find_last_not_of(" \t") + 1);
-                    content_length = std::stoull(cl_str);
-                }
-                break;
+            st->prepared = true;
+            return false;
+        }
+        st->responses.push_back(std::move(resp));
+        fast_lane_timer_.record(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+    st->conn.reactor->complete(st->conn, std::move(st->responses), st->batch.back().keep_alive);
+    delete st;
+    return true;
+}
+
+// Slow lane: works through the batch on a worker. With async DB
+// connections a request that needs Postgres parks the batch: the statement
+// is sent from the reactor that owns the client, the worker returns to the
+// pool, and the batch resumes on whichever worker picks it up once the
+// result is in. A GET miss on a key that is already being fetched parks
+// the same way until that fetch finishes, whatever the DB mode. A parked
+// batch has exactly one continuation pending, so the state is handed along
+// as a plain pointer and freed once the responses are out.
+void HTTPServer::run_batch(BatchState *st)
+{
+    while (st->next() < st->batch.size())
+    {
+        const HttpRequest &req = st->batch[st->next()];
+        if (!st->prepared)
+        {
+            HttpResponse resp;
+            st->db = DBRequest{};
+            if (begin_request(req, st->db, resp))
+            {
+                st->responses.push_back(std::move(resp));
+                continue;
             }
         }
+        st->prepared = false;
+        if (st->db.scan)
+        {
+            if (start_scan(st))
+                return;   // streaming; scan_step() picks the batch up again
+            continue;
+        }
+        if (st->db.op.kind == DBOp::Kind::Get && !st->db.multi &&
+            !flights_.join(st->db.key, [this, st](const SingleFlight::Result &r)
+                           {
+                               st->flight = r;
+                               thread_pool_->enqueue([this, st]()
+                               {
+                                   const HttpRequest &req = st->batch[st->next()];
+                                   st->responses.push_back(miss_response(req, st->flight));
+                                   st->flight = SingleFlight::Result{};
+                                   run_batch(st);
+                               });
+                           }))
+        {
+            return;   // parked behind the fetch already running for this key
+        }
+        if (async_dbs_.empty() || st->db.multi)
+        {
+            st->db.acquire_timeout = acquire_timeout(st);
+            run_db_sync(st->db);
+            st->responses.push_back(finish_request(req, st->db));
+            continue;
+        }
+
+        Reactor *loop = st->conn.reactor;
+        loop->post([this, st, loop]()
+                   {
+                       async_db_for(loop).submit(&st->db.op, [this, st](bool delivered)
+                       {
+                           // delivered but failed (an error result) is no miss either
+                           st->db.status = delivered && st->db.op.ok ? DBStatus::Ok : DBStatus::Unavailable;
+                           thread_pool_->enqueue([this, st]()
+                           {
+                               const HttpRequest &req = st->batch[st->next()];
+                               st->responses.push_back(finish_request(req, st->db));
+                               run_batch(st);
+                           });
+                       });
+                   });
+        return;
+    }
+    slow_lane_timer_.record(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - st->handed_off).count());
+    st->conn.reactor->complete(st->conn, std::move(st->responses), st->batch.back().keep_alive);
+    delete st;
+}
+
+// Answers whatever is left of a batch that is over its latency budget or
+// found the worker queue full. Nothing in it has touched Postgres or
+// joined a fetch yet, so it can simply be refused.
+void HTTPServer::shed(BatchState *st)
+{
+    while (st->next() < st->batch.size())
+    {
+        const HttpRequest &req = st->batch[st->next()];
+        st->responses.push_back(req.binary ? binary_response(binproto::kBusy)
+                                           : make_response(req, kServiceUnavailable, kRetryAfter, "OVERLOADED"));
+    }
+    st->conn.reactor->complete(st->conn, std::move(st->responses), st->batch.back().keep_alive);
+    delete st;
+}
 
-        if (request.empty() || !headers_complete)
+// The connection wait allowed for a statement of this batch: --db-timeout,
+// cut down to whatever is left of the latency budget.
+std::chrono::milliseconds HTTPServer::acquire_timeout(const BatchState *st) const
+{
+    if (!latency_budget_.count())
+        return db_timeout_;
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        st->handed_off + latency_budget_ - std::chrono::steady_clock::now());
+    left = std::max(left, std::chrono::milliseconds(1));
+    return db_timeout_.count() ? std::min(left, db_timeout_) : left;
+}
+
+// Opens the cursor and sends whatever the batch has answered so far plus
+// the chunked response head; rows follow from scan_step(), one chunk at a
+// time, each fetched only once the previous one is on the wire. False if
+// the scan could not start, with the error response already queued.
+bool HTTPServer::start_scan(BatchState *st)
+{
+    const HttpRequest &req = st->batch[st->next()];
+    DBRequest &db = st->db;
+    Storage *conn = db_pool_->acquire(acquire_timeout(st));
+    if (!conn)
+    {
+        st->responses.push_back(db_error_response(req, DBStatus::Busy, ""));
+        return false;
+    }
+    // Taken before the cursor opens, so a write flushed in between is seen
+    // twice rather than not at all; the buffered copy wins. A pending
+    // delete hides a row the store counts towards its limit.
+    size_t store_limit = db.scan_limit;
+    if (write_behind_)
+    {
+        db.scan_pending = write_behind_->pending(db.scan_prefix, db.scan_start);
+        db.scan_next = db.scan_pending.begin();
+        for (const auto &p : db.scan_pending)
         {
-            break; // Connection closed or error
+            if (store_limit && store_limit < kMaxScanLimit && !p.second)
+                store_limit++;
         }
-        
-        // Read body if Content-Length specified
-        if (content_length > 0) {
-            size_t body_start = header_end_pos + 4;
-            size_t body_received = request.size() - body_start;
-            
-            while (body_received < content_length) {
-                bytes = recv(client_fd, buffer, 
-                           std::min(sizeof(buffer), content_length - body_received), 0);
-                if (bytes <= 0) {
-                    keep_alive = false;
-                    break;
-                }
-                request.append(buffer, bytes);
-                body_received += bytes;
-            }
+    }
+    if (!conn->scan_open(db.scan_prefix, db.scan_start, store_limit))
+    {
+        db_pool_->release(conn);
+        st->responses.push_back(db_error_response(req, DBStatus::Unavailable, ""));
+        return false;
+    }
+    st->scan_conn = conn;
+    scans_.fetch_add(1, std::memory_order_relaxed);
+
+    std::vector<HttpResponse> out = std::move(st->responses);
+    st->responses.clear();
+    st->sent += out.size();
+    HttpResponse head;
+    head.head = std::string(kOK) + "\r\n"
+                "Transfer-Encoding: chunked\r\n"
+                "Connection: " + (req.keep_alive ? "keep-alive" : "close") + "\r\n\r\n";
+    out.push_back(std::move(head));
+    st->conn.reactor->send_partial(st->conn, std::move(out), [this, st](bool alive)
+                                   { thread_pool_->enqueue([this, st, alive]() { scan_step(st, alive); }); });
+    return true;
+}
+
+void HTTPServer::scan_step(BatchState *st, bool alive)
+{
+    DBRequest &db = st->db;
+    std::vector<Storage::Row> rows;
+    bool ok = alive;
+    bool done = db.scan_limit && db.scan_sent == db.scan_limit;
+    // pending deletes can hide every row of a chunk; fetch on until there
+    // is something to send or the cursor is exhausted
+    while (ok && !done && rows.empty())
+    {
+        ok = st->scan_conn->scan_fetch(kScanChunkRows, rows);
+        done = ok && rows.empty();
+        if (ok && !db.scan_pending.empty())
+            merge_pending(db, rows, done);
+    }
+    if (db.scan_limit && rows.size() > db.scan_limit - db.scan_sent)
+        rows.resize(db.scan_limit - db.scan_sent);
+    if (ok && !rows.empty())
+    {
+        db.scan_sent += rows.size();
+        scan_rows_.fetch_add(rows.size(), std::memory_order_relaxed);
+        HttpResponse chunk;
+        chunk.head = scan_chunk(rows);
+        st->conn.reactor->send_partial(st->conn, {std::move(chunk)}, [this, st](bool alive)
+                                       { thread_pool_->enqueue([this, st, alive]() { scan_step(st, alive); }); });
+        return;
+    }
+
+    st->scan_conn->scan_close();
+    db_pool_->release(st->scan_conn);
+    st->scan_conn = nullptr;
+    if (!ok)
+    {
+        // the status line is long gone: cut the body short and close
+        st->conn.reactor->complete(st->conn, {}, false);
+        delete st;
+        return;
+    }
+    HttpResponse last;
+    last.head = "0\r\n\r\n";
+    st->responses.push_back(std::move(last));
+    run_batch(st);
+}
+
+// Merges the write-behind writes still pending into a chunk of store rows,
+// both in key order: a pending value replaces the row or adds one, a
+// pending delete drops it. Once the store is exhausted, the rest of the
+// pending values follow, a chunk at a time. A row is checked against the
+// whole map, so none goes out stale even where the database collation
+// orders keys differently; the pending ones are placed in byte order.
+void HTTPServer::merge_pending(DBRequest &db, std::vector<Storage::Row> &rows, bool exhausted)
+{
+    auto &p = db.scan_next;
+    std::vector<Storage::Row> merged;
+    merged.reserve(rows.size());
+    auto take = [&]()
+    {
+        if (p->second)
+            merged.emplace_back(p->first, *p->second);
+        ++p;
+    };
+    for (auto &r : rows)
+    {
+        while (p != db.scan_pending.end() && p->first <= r.first)
+            take();
+        if (!db.scan_pending.count(r.first))
+            merged.push_back(std::move(r));
+    }
+    while (exhausted && p != db.scan_pending.end() && merged.size() < kScanChunkRows)
+        take();
+    rows.swap(merged);
+}
+
+// Least loaded of the async connections owned by the given loop.
+AsyncDatabase &HTTPServer::async_db_for(Reactor *loop)
+{
+    size_t i = 0;
+    while (reactors_[i].get() != loop)
+        ++i;
+    auto &conns = async_dbs_[i];
+    AsyncDatabase *best = conns[0].get();
+    for (auto &c : conns)
+    {
+        if (c->in_flight() < best->in_flight())
+            best = c.get();
+    }
+    return *best;
+}
+
+// Answers whatever the cache or the server alone can answer. Otherwise
+// fills db with the statement the request needs and returns false; the
+// response then comes from finish_request() once the statement has run.
+bool HTTPServer::begin_request(const HttpRequest &req, DBRequest &db, HttpResponse &resp)
+{
+    std::string_view method = req.method;
+    std::string_view path = req.path;
+
+    std::string key;
+    if (req.binary)
+    {
+        key = path;
+    }
+    else if (path.substr(0, 4) == "/kv/")
+    {
+        key = path.substr(4);
+    }
+
+    // -------------------------- PUT --------------------------
+    if (method == "PUT" && !key.empty())
+    {
+        begin_write();
+        if (write_behind_)
+        {
+            // buffered before it is cached, so fill_cache() sees it
+            auto stored = std::make_shared<const std::string>(req.body);
+            write_behind_->write(key, stored);
+            cache_->put(key, std::move(stored));
+            end_write();
+            resp = ok_response(req);
+            return true;
         }
+        db.key = std::move(key);
+        db.stored = std::make_shared<const std::string>(req.body);
+        db.op.kind = DBOp::Kind::Put;
+        db.op.value = db.stored.get();
+    }
 
-        // Parse request
-        std::istringstream stream(request);
-        std::string method, path, version;
-        stream >> method >> path >> version;
-
-        // Check for Connection header
-        size_t conn_pos = request.find("Connection:");
-        if (conn_pos != std::string::npos) {
-            size_t conn_start = conn_pos + 11;
-            size_t conn_end = request.find("\r\n", conn_start);
-            std::string conn_val = request.substr(conn_start, conn_end - conn_start);
-            // Trim and check
-            conn_val.erase(0, conn_val.find_first_not_of(" \t"));
-            conn_val.erase(conn_val.find_last_not_of(" \t") + 1);
-            if (conn_val == "close") {
-                keep_alive = false;
-            }
+    // -------------------------- GET --------------------------
+    else if (method == "GET" && !key.empty())
+    {
+        CacheValue value = cache_->get(key);
+        if (value)
+        {
+            resp = hit_response(req, std::move(value));
+            return true;
+        }
+        // evicted or deleted but not yet flushed: the table is stale
+        WriteBehind::Lookup pending = WriteBehind::Lookup::Absent;
+        if (write_behind_)
+        {
+            db.since = write_behind_->version();
+            pending = write_behind_->lookup(key, value);
         }
+        if (pending == WriteBehind::Lookup::Found)
+        {
+            fill_cache(key, value, db.since);
+            resp = hit_response(req, std::move(value));
+            return true;
+        }
+        if (pending == WriteBehind::Lookup::Deleted)
+        {
+            resp = not_found_response(req);
+            return true;
+        }
+        db.key = std::move(key);
+        db.op.kind = DBOp::Kind::Get;
+    }
 
-        std::string body;
-        size_t body_pos = request.find("\r\n\r\n");
-        if (body_pos != std::string::npos)
+    // -------------------------- DELETE --------------------------
+    else if (method == "DELETE" && !key.empty())
+    {
+        begin_write();
+        if (write_behind_)
         {
-            body = request.substr(body_pos + 4);
+            write_behind_->write(key, nullptr);
+            cache_->remove(key);
+            end_write();
+            resp = ok_response(req);
+            return true;
         }
+        db.key = std::move(key);
+        db.op.kind = DBOp::Kind::Remove;
+    }
 
-        std::string key;
-        if (path.rfind("/kv/", 0) == 0)
+    // -------------------------- MGET / MPUT --------------------------
+    else if (method == "POST" && (path == "/_mget" || path == "/_mput"))
+    {
+        return begin_multi(req, path == "/_mput", db, resp);
+    }
+    else if (req.binary && method == "MGET")
+    {
+        return begin_multi(req, false, db, resp);
+    }
+
+    // -------------------------- SCAN --------------------------
+    else if (method == "GET" && (path == "/kv" || path.substr(0, 4) == "/kv?"))
+    {
+        std::string_view query = path.size() > 4 ? path.substr(4) : std::string_view();
+        std::string limit = query_param(query, "limit");
+        size_t scan_limit = 0;
+        if (!limit.empty())
         {
-            key = path.substr(4);
+            char *end = nullptr;
+            errno = 0;
+            scan_limit = std::strtoull(limit.c_str(), &end, 10);
+            if (*end != '\0' || !std::isdigit(static_cast<unsigned char>(limit[0])) || errno == ERANGE ||
+                scan_limit > kMaxScanLimit)
+            {
+                resp = make_response(req, kBadRequest, "", "BAD_REQUEST");
+                return true;
+            }
         }
+        db.scan = true;
+        db.scan_prefix = query_param(query, "prefix");
+        db.scan_start = query_param(query, "start");
+        db.scan_limit = scan_limit;
+        return false;
+    }
+
+    // -------------------------- STATS --------------------------
+    else if (method == "GET" && path == "/stats")
+    {
+        resp = make_response(req, kOK, "", stats_report());
+        return true;
+    }
+
+    // -------------------------- BAD REQUEST --------------------------
+    else
+    {
+        resp = bad_request(req);
+        return true;
+    }
+
+    db.op.key = &db.key;
+    return false;
+}
+
+HttpResponse HTTPServer::finish_request(const HttpRequest &req, DBRequest &db)
+{
+    if (db.multi)
+        return finish_multi(req, db);
+    if (db.op.kind == DBOp::Kind::Get)
+    {
+        SingleFlight::Result r{db.status, nullptr};
+        if (db.status == DBStatus::Ok && db.op.result)
+        {
+            r.value = std::make_shared<const std::string>(std::move(*db.op.result));
+            fill_cache(db.key, r.value, db.since);
+        }
+        flights_.finish(db.key, r);
+        return miss_response(req, r);
+    }
+
+    if (db.status == DBStatus::Ok && db.op.kind == DBOp::Kind::Put)
+        cache_->put(db.key, std::move(db.stored));
+    else if (db.status == DBStatus::Ok)
+        cache_->remove(db.key);
+    end_write();
+    if (db.status != DBStatus::Ok)
+        return db_error_response(req, db.status, "");
+    return ok_response(req);
+}
+
+// Caches a value read from the store. Under write-behind the store lags:
+// a write made while the read was out is newer than what it returned and
+// may already be in the cache, so the fill is taken back out again (the
+// next GET finds the write in the buffer). Writes buffer themselves
+// before they touch the cache, so one that written_since() misses caches
+// its value after this fill and wins.
+void HTTPServer::fill_cache(const std::string &key, const CacheValue &value, uint64_t since)
+{
+    cache_->put(key, value);
+    if (write_behind_ && write_behind_->written_since(key, since))
+        cache_->remove(key);
+}
+
+// GET answered by a database fetch, its own or the one it waited on.
+HttpResponse HTTPServer::miss_response(const HttpRequest &req, const SingleFlight::Result &r)
+{
+    const char *cache_header = "X-Cache-Status: MISS\r\n";
+    if (r.status != DBStatus::Ok)
+        return db_error_response(req, r.status, cache_header);
+    if (!r.value)
+        return not_found_response(req);
+    if (req.binary)
+        return binary_response(binproto::kOk, {}, r.value);
+    return make_response(req, kOK, cache_header, "DB_VALUE:", r.value);
+}
+
+void HTTPServer::run_db_sync(DBRequest &db)
+{
+    if (db.multi)
+    {
+        run_multi_sync(db);
+        return;
+    }
+    switch (db.op.kind)
+    {
+    case DBOp::Kind::Put:
+        db.status = db_put(db.key, *db.stored, db.acquire_timeout);
+        break;
+    case DBOp::Kind::Get:
+        db.status = db_get(db.key, db.op.result, db.acquire_timeout);
+        break;
+    case DBOp::Kind::Remove:
+        db.status = db_remove(db.key, db.acquire_timeout);
+        break;
+    }
+}
+
+// A pool that stays exhausted past the acquire timeout is overload, not
+// failure: the client gets 503 and is told when to retry.
+HttpResponse HTTPServer::db_error_response(const HttpRequest &req, DBStatus status, const char *headers)
+{
+    if (req.binary)
+        return binary_response(status == DBStatus::Busy ? binproto::kBusy : binproto::kError);
+    if (status == DBStatus::Busy)
+    {
+        std::string retry = std::string(headers) + kRetryAfter;
+        return make_response(req, kServiceUnavailable, retry.c_str(), "DB_BUSY");
+    }
+    return make_response(req, kServerError, headers, "DB_UNAVAILABLE");
+}
 
-        std::string response_body, status = "HTTP/1.1 200 OK", headers;
+// Statements go through the pipelined connections when --db-pipeline is
+// set, otherwise over a pooled connection. A statement that failed is
+// Unavailable: a read is not answered as a miss, nor a write as done.
+DBStatus HTTPServer::db_put(const std::string &key, const std::string &value,
+                             std::chrono::milliseconds timeout)
+{
+    if (db_pipeline_)
+        return db_pipeline_->put(key, value) ? DBStatus::Ok : DBStatus::Unavailable;
+    Storage *conn = db_pool_->acquire(timeout);
+    if (!conn)
+        return DBStatus::Busy;
+    bool ok = conn->put(key, value);
+    db_pool_->release(conn);
+    return ok ? DBStatus::Ok : DBStatus::Unavailable;
+}
 
-        // -------------------------- PUT --------------------------
-        if (method == "PUT" && !key.empty())
+DBStatus HTTPServer::db_get(const std::string &key, std::optional<std::string> &value,
+                             std::chrono::milliseconds timeout)
+{
+    if (db_pipeline_)
+        return db_pipeline_->get(key, value) ? DBStatus::Ok : DBStatus::Unavailable;
+    Storage *conn = db_pool_->acquire(timeout);
+    if (!conn)
+        return DBStatus::Busy;
+    bool ok = conn->get(key, value);
+    db_pool_->release(conn);
+    return ok ? DBStatus::Ok : DBStatus::Unavailable;
+}
+
+DBStatus HTTPServer::db_remove(const std::string &key, std::chrono::milliseconds timeout)
+{
+    if (db_pipeline_)
+        return db_pipeline_->remove(key) ? DBStatus::Ok : DBStatus::Unavailable;
+    Storage *conn = db_pool_->acquire(timeout);
+    if (!conn)
+        return DBStatus::Busy;
+    bool ok = conn->remove(key);
+    db_pool_->release(conn);
+    return ok ? DBStatus::Ok : DBStatus::Unavailable;
+}
+
+// _mget answers from the cache (and the write-behind buffer) first and
+// leaves only the misses for one SELECT ... = ANY; _mput is one multi-row
+// upsert, or straight into the write-behind buffer when that is on.
+bool HTTPServer::begin_multi(const HttpRequest &req, bool put, DBRequest &db, HttpResponse &resp)
+{
+    bool parsed = req.binary ? binproto::parse_keys(req.body, db.keys) && db.keys.size() <= kMaxMultiKeys
+                  : put      ? parse_records(req.body, db.keys, db.values)
+                             : parse_key_list(req.body, db.keys);
+    if (!parsed)
+    {
+        resp = bad_request(req);
+        return true;
+    }
+
+    if (put)
+    {
+        begin_write();
+        if (write_behind_)
         {
-            Database* conn = db_pool_->acquire();
-            if (!conn) {
-                status = "HTTP/1.1 500 Internal Server Error";
-                response_body = "DB_UNAVAILABLE";
-            } else {
-                conn->put(key, body);
-                db_pool_->release(conn);
-                cache_->put(key, body);
-                response_body = "OK";
+            for (size_t i = 0; i < db.keys.size(); ++i)
+            {
+                write_behind_->write(db.keys[i], db.values[i]);
+                cache_->put(db.keys[i], db.values[i]);
             }
+            end_write();
+            resp = make_response(req, kOK, "", "OK " + std::to_string(db.keys.size()));
+            return true;
+        }
+        db.multi = true;
+        db.op.kind = DBOp::Kind::Put;
+        return false;
+    }
+
+    db.op.kind = DBOp::Kind::Get;
+    db.values.resize(db.keys.size());
+    if (write_behind_)
+        db.since = write_behind_->version();
+    for (size_t i = 0; i < db.keys.size(); ++i)
+    {
+        CacheValue value = cache_->get(db.keys[i]);
+        WriteBehind::Lookup pending = WriteBehind::Lookup::Absent;
+        if (!value && write_behind_)
+        {
+            pending = write_behind_->lookup(db.keys[i], value);
+            if (pending == WriteBehind::Lookup::Found)
+                fill_cache(db.keys[i], value, db.since);
+        }
+        if (value || pending == WriteBehind::Lookup::Deleted)
+            db.hits++;
+        else
+            db.missing.push_back(i);
+        db.values[i] = std::move(value);
+    }
+    if (db.missing.empty())
+    {
+        resp = finish_multi(req, db);
+        return true;
+    }
+    db.multi = true;
+    return false;
+}
+
+void HTTPServer::run_multi_sync(DBRequest &db)
+{
+    Storage *conn = db_pool_->acquire(db.acquire_timeout);
+    if (!conn)
+    {
+        db.status = DBStatus::Busy;
+        return;
+    }
+
+    bool ok;
+    if (db.op.kind == DBOp::Kind::Put)
+    {
+        std::vector<Storage::KeyValue> rows;
+        rows.reserve(db.keys.size());
+        for (size_t i = 0; i < db.keys.size(); ++i)
+            rows.emplace_back(&db.keys[i], db.values[i].get());
+        ok = conn->write_batch(rows, {});
+    }
+    else
+    {
+        std::vector<const std::string *> keys;
+        keys.reserve(db.missing.size());
+        for (size_t i : db.missing)
+            keys.push_back(&db.keys[i]);
+        std::vector<std::optional<std::string>> fetched;
+        ok = conn->get_many(keys, fetched);
+        for (size_t j = 0; ok && j < fetched.size(); ++j)
+        {
+            if (!fetched[j])
+                continue;
+            size_t i = db.missing[j];
+            db.values[i] = std::make_shared<const std::string>(std::move(*fetched[j]));
+            fill_cache(db.keys[i], db.values[i], db.since);
         }
+    }
+    db_pool_->release(conn);
+    db.status = ok ? DBStatus::Ok : DBStatus::Unavailable;
+}
+
+HttpResponse HTTPServer::finish_multi(const HttpRequest &req, DBRequest &db)
+{
+    if (db.op.kind == DBOp::Kind::Put)
+    {
+        for (size_t i = 0; db.status == DBStatus::Ok && i < db.keys.size(); ++i)
+            cache_->put(db.keys[i], std::move(db.values[i]));
+        end_write();
+        if (db.status != DBStatus::Ok)
+            return db_error_response(req, db.status, "");
+        return make_response(req, kOK, "", "OK " + std::to_string(db.keys.size()));
+    }
+    if (db.status != DBStatus::Ok)
+        return db_error_response(req, db.status, "");
+    if (req.binary)
+    {
+        uint8_t status = binproto::kOk | (db.hits == db.keys.size() ? binproto::kCached : 0);
+        return binary_response(status, binary_mget_body(db.values));
+    }
+    std::string headers = "X-Cache-Hits: " + std::to_string(db.hits) + "\r\n";
+    return make_response(req, kOK, headers.c_str(), mget_body(db.values));
+}
+
+// A write that starts while a snapshot is being taken, or while one on
+// disk still matches the store, voids it: the store is about to move on.
+// The increment comes before the gate check and take_snapshot() raises
+// the gate before counting, so between the two every write is seen.
+void HTTPServer::begin_write()
+{
+    writes_in_flight_.fetch_add(1);
+    if (!snapshot_gate_.load())
+        return;
+    std::lock_guard<std::mutex> lock(snapshot_mtx_);
+    snapshot_dirty_ = true;
+    if (snapshot_live_)
+    {
+        // Once per snapshot, before this write can reach the store: with
+        // the epoch cleared, a crash cannot leave a matching pair behind
+        // even if the unlink never made it to disk. Should the store
+        // refuse, the synced unlink still keeps the file from coming back.
+        Storage *store = db_pool_->acquire();
+        if (!store || !store->store_epoch(""))
+            std::cerr << "Cache snapshot: cannot clear the store's epoch\n";
+        if (store)
+            db_pool_->release(store);
+        cache_snapshot::remove(config_.snapshot_path);
+        snapshot_live_ = false;
+        snapshot_gate_ = false;
+    }
+}
 
-        // -------------------------- GET --------------------------
-        else if (method == "GET" && !key.empty())
+// once the write's outcome is in the cache
+void HTTPServer::end_write()
+{
+    writes_in_flight_.fetch_sub(1);
+}
+
+// Fills the cache straight from the store before any traffic. Rows picked
+// by count or prefix are split over the connections into disjoint parts
+// of the store, one dump each; a key list is handed out in chunks of kPrewarmChunk to
+// whichever connection is free. Runs before a snapshot is loaded, whose
+// entries are the hotter ones and should be the last in.
+void HTTPServer::prewarm()
+{
+    std::vector<std::string> keys;
+    bool by_key = !config_.prewarm_keys_file.empty();
+    if (by_key)
+    {
+        std::ifstream in(config_.prewarm_keys_file);
+        if (!in)
+        {
+            std::cerr << "Prewarm: cannot open " << config_.prewarm_keys_file << "\n";
+            return;
+        }
+        std::string line;
+        while (std::getline(in, line))
         {
-            auto cached = cache_->get(key);
+            if (!line.empty())
+                keys.push_back(std::move(line));
+        }
+    }
+
+    size_t conns = std::max<size_t>(1, std::min(config_.prewarm_conns, config_.db_pool_size));
+    std::atomic<size_t> rows{0};
+    std::atomic<size_t> bytes{0};
+    std::atomic<size_t> next_chunk{0};
+    std::atomic<bool> failed{false};
+    auto start = std::chrono::steady_clock::now();
 
-            if (cached)
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < conns; ++i)
+    {
+        threads.emplace_back([&, i]
+        {
+            Storage *store = db_pool_->acquire();
+            if (!store)
             {
-                std::string value = *cached;
-                std::string prefix = "VALUE:";
-                std::string suffix = ":END";
-                response_body = prefix + value + suffix;
-                headers += "X-Cache-Status: HIT\r\n";
+                failed = true;
+                return;
+            }
+            Storage::RowSink sink = [&](std::string key, std::string value)
+            {
+                bytes.fetch_add(key.size() + value.size(), std::memory_order_relaxed);
+                cache_->put(key, std::make_shared<const std::string>(std::move(value)));
+                rows.fetch_add(1, std::memory_order_relaxed);
+            };
+            Storage::DumpFilter filter;
+            filter.prefix = config_.prewarm_prefix;
+            if (!by_key)
+            {
+                filter.part = static_cast<uint32_t>(i);
+                filter.parts = static_cast<uint32_t>(conns);
+                size_t limit = config_.prewarm_rows;
+                filter.limit = limit / conns + (i < limit % conns ? 1 : 0);
+                if ((!limit || filter.limit) && !store->dump(filter, sink))
+                    failed = true;
             }
             else
             {
-                Database* conn = db_pool_->acquire();
-                if (!conn) {
-                    status = "HTTP/1.1 500 Internal Server Error";
-                    response_body = "DB_UNAVAILABLE";
-                    headers += "X-Cache-Status: MISS\r\n";
-                } else {
-                    auto db_value = conn->get(key);
-                    db_pool_->release(conn);
-
-                    if (db_value)
-                    {
-                        response_body = "DB_VALUE:" + *db_value;
-                        cache_->put(key, *db_value);
-                        headers += "X-Cache-Status: MISS\r\n";
-                    }
-                    else
+                for (size_t c; (c = next_chunk.fetch_add(1)) * kPrewarmChunk < keys.size();)
+                {
+                    filter.keys = &keys[c * kPrewarmChunk];
+                    filter.num_keys = std::min(kPrewarmChunk, keys.size() - c * kPrewarmChunk);
+                    if (!store->dump(filter, sink))
                     {
-                        response_body = "NOT_FOUND";
-                        status = "HTTP/1.1 404 Not Found";
-                        headers += "X-Cache-Status: MISS\r\n";
+                        failed = true;
+                        break;
                     }
                 }
             }
-        }
+            db_pool_->release(store);
+        });
+    }
+    for (auto &t : threads)
+        t.join();
 
-        // -------------------------- DELETE --------------------------
-        else if (method == "DELETE" && !key.empty())
-        {
-            Database* conn = db_pool_->acquire();
-            if (!conn) {
-                status = "HTTP/1.1 500 Internal Server Error";
-                response_body = "DB_UNAVAILABLE";
-            } else {
-                conn->remove(key);
-                db_pool_->release(conn);
-                cache_->remove(key);
-                response_body = "OK";
-            }
-        }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Prewarm: " << rows.load() << " rows (" << (bytes.load() >> 20) << " MB) over " << conns
+              << " connections in " << static_cast<long>(secs * 1000) << " ms, "
+              << static_cast<long>(secs > 0 ? rows.load() / secs : 0) << " rows/s; cache holds "
+              << cache_->size() << std::endl;
+    if (failed)
+        std::cerr << "Prewarm: some rows could not be read, the cache is only partly warm\n";
+}
 
-        // -------------------------- BAD REQUEST --------------------------
-        else
+// Warm start: fills the cache from the snapshot left by the last run if
+// the store still carries its epoch. A snapshot that loads stays on disk,
+// good for another restart, until the first write; any other is removed.
+void HTTPServer::load_snapshot()
+{
+    auto start = std::chrono::steady_clock::now();
+    std::string epoch;
+    Storage *store = db_pool_->acquire();
+    bool ok = store && store->load_epoch(epoch);
+    if (store)
+        db_pool_->release(store);
+    if (!ok)
+    {
+        std::cerr << "Cache snapshot: cannot read the store's epoch, starting cold\n";
+        return;
+    }
+
+    cache_snapshot::LoadResult r = cache_snapshot::load(config_.snapshot_path, epoch, *cache_);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    switch (r.status)
+    {
+    case cache_snapshot::LoadStatus::Missing:
+        return;
+    case cache_snapshot::LoadStatus::Loaded:
+        std::cout << "Cache snapshot: " << r.entries << " entries (" << (r.bytes >> 20) << " MB) loaded in "
+                  << ms << " ms" << std::endl;
         {
-            response_body = "BAD_REQUEST";
-            status = "HTTP/1.1 400 Bad Request";
+            std::lock_guard<std::mutex> lock(snapshot_mtx_);
+            snapshot_live_ = true;
+            snapshot_gate_ = true;
         }
+        return;
+    case cache_snapshot::LoadStatus::Stale:
+        std::cerr << "Cache snapshot: the store has moved on since it was taken, starting cold\n";
+        break;
+    case cache_snapshot::LoadStatus::Corrupt:
+        std::cerr << "Cache snapshot: damaged after " << r.entries << " entries\n";
+        break;
+    }
+    unlink(config_.snapshot_path.c_str());
+}
 
-        // -------------------------- SEND RESPONSE --------------------------
-        std::string connection_header = keep_alive ? "keep-alive" : "close";
-        std::string response = status + "\r\n" + 
-                             headers +
-                             "Connection: " + connection_header + "\r\n" +
-                             "Content-Length: " + std::to_string(response_body.size()) + "\r\n" +
-                             "\r\n" + response_body;
-
-        ssize_t sent = send(client_fd, response.c_str(), response.size(), MSG_NOSIGNAL);
-        if (sent < 0) {
-            break; // Connection error
-        }
-        
-        if (!keep_alive) {
-            break;
-        }
+// Writes the cache out under a fresh epoch, stored with the data before
+// the file is renamed into place. Writes already running when the gate
+// goes up are waited out, as the cache may not show them yet; any write
+// that starts after it voids the snapshot. The rename happens under
+// snapshot_mtx_, so such a write has either marked it dirty by then or
+// finds it live and unlinks it.
+bool HTTPServer::take_snapshot(size_t &entries)
+{
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mtx_);
+        snapshot_dirty_ = false;
+        snapshot_gate_ = true;
+    }
+    auto deadline = std::chrono::steady_clock::now() + kSnapshotDrain;
+    while (writes_in_flight_.load() > 0 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    std::string epoch = cache_snapshot::new_epoch();
+    std::string tmp = config_.snapshot_path + ".tmp";
+    bool ok = writes_in_flight_.load() == 0;
+    if (ok)
+    {
+        std::vector<Cache::Entry> all;
+        cache_->entries(all);
+        entries = all.size();
+        ok = cache_snapshot::write(tmp, epoch, all);
+    }
+    if (ok)
+    {
+        Storage *store = db_pool_->acquire();
+        ok = store && store->store_epoch(epoch);
+        if (store)
+            db_pool_->release(store);
+    }
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mtx_);
+        ok = ok && !snapshot_dirty_ && rename(tmp.c_str(), config_.snapshot_path.c_str()) == 0;
+        if (ok)
+            snapshot_live_ = true;
+        snapshot_gate_ = snapshot_live_;
+    }
+    if (!ok)
+        unlink(tmp.c_str());
+    (ok ? snapshots_written_ : snapshots_dropped_).fetch_add(1, std::memory_order_relaxed);
+    return ok;
+}
+
+// Every snapshot_interval_s while running. Under a steady stream of
+// writes most of these are dropped; a read-mostly cache keeps a fresh one.
+void HTTPServer::snapshot_loop()
+{
+    std::unique_lock<std::mutex> lock(snapshot_mtx_);
+    while (!snapshot_cv_.wait_for(lock, std::chrono::seconds(config_.snapshot_interval_s),
+                                  [this] { return snapshot_stop_; }))
+    {
+        lock.unlock();
+        size_t entries = 0;
+        take_snapshot(entries);
+        lock.lock();
     }
-    
-    close(client_fd);
+}
+
+// One "name value" pair per line, cheap enough to poll during a load run.
+std::string HTTPServer::stats_report() const
+{
+    CacheStats cs = cache_->stats();
+    uint64_t lookups = cs.hits + cs.misses;
+    double hit_rate = lookups ? 100.0 * cs.hits / lookups : 0.0;
+
+    size_t connections = 0;
+    for (const auto &r : reactors_)
+        connections += r->connection_count();
+
+    std::ostringstream out;
+    out << "cache_entries " << cs.entries << "\n"
+        << "cache_hits " << cs.hits << "\n"
+        << "cache_misses " << cs.misses << "\n"
+        << "cache_hit_rate " << hit_rate << "\n"
+        << "cache_admitted " << cs.admitted << "\n"
+        << "cache_rejected " << cs.rejected << "\n"
+        << "cache_evictions " << cs.evictions << "\n";
+    if (cs.memory_limit)
+    {
+        out << "cache_memory_used " << cs.memory_used << "\n"
+            << "cache_memory_limit " << cs.memory_limit << "\n";
+    }
+    out << cache_->engine_report();
+    out << "scans " << scans_.load() << "\n"
+        << "scan_rows " << scan_rows_.load() << "\n"
+        << "snapshots_written " << snapshots_written_.load() << "\n"
+        << "snapshots_dropped " << snapshots_dropped_.load() << "\n"
+        << "rss_bytes " << resident_bytes() << "\n";
+    out << "shed_queue_full " << shed_queue_full_.load() << "\n"
+        << "shed_deadline " << shed_deadline_.load() << "\n"
+        << "slow_lane_pending " << slow_lane_pending_.load() << "\n";
+    out << "coalesced_misses " << flights_.coalesced() << "\n"
+        << "db_pool_timeouts " << db_pool_->timeouts() << "\n"
+        << "db_pool_affinity_hits " << db_pool_->affinity_hits() << "\n";
+
+    QueryStats fast = fast_lane_timer_.load();
+    QueryStats wait = slow_lane_wait_.load();
+    QueryStats slow = slow_lane_timer_.load();
+    out << "fast_lane_requests " << fast.count << "\n"
+        << "fast_lane_avg_us " << (fast.count ? fast.total_us / fast.count : 0) << "\n"
+        << "fast_lane_max_us " << fast.max_us << "\n"
+        << "slow_lane_batches " << slow.count << "\n"
+        << "slow_lane_queue_wait_avg_us " << (wait.count ? wait.total_us / wait.count : 0) << "\n"
+        << "slow_lane_queue_wait_max_us " << wait.max_us << "\n"
+        << "slow_lane_avg_us " << (slow.count ? slow.total_us / slow.count : 0) << "\n"
+        << "slow_lane_max_us " << slow.max_us << "\n";
+
+    ThreadPoolStats ps = thread_pool_->stats();
+    out << "pool_queue_depth " << ps.queue_depth << "\n"
+        << "pool_tasks_executed " << ps.executed << "\n"
+        << "pool_tasks_injected " << ps.injected << "\n"
+        << "pool_steals " << ps.steals << "\n"
+        << "pool_parks " << ps.parks << "\n";
+
+    DBStats db = db_pool_->stats();
+    if (db_pipeline_)
+        db += db_pipeline_->stats();
+    for (const auto &conns : async_dbs_)
+    {
+        for (const auto &c : conns)
+            db += c->stats();
+    }
+    const std::pair<const char *, const QueryStats &> queries[] = {
+        {"put", db.put}, {"get", db.get}, {"delete", db.remove}, {"scan", db.scan}};
+    for (const auto &q : queries)
+    {
+        double avg = q.second.count ? double(q.second.total_us) / q.second.count : 0.0;
+        out << "db_" << q.first << "_queries " << q.second.count << "\n"
+            << "db_" << q.first << "_avg_us " << avg << "\n"
+            << "db_" << q.first << "_max_us " << q.second.max_us << "\n";
+    }
+    if (write_behind_)
+    {
+        WriteBehind::Stats wb = write_behind_->stats();
+        out << "write_behind_dirty " << wb.dirty << "\n"
+            << "write_behind_writes " << wb.writes << "\n"
+            << "write_behind_coalesced " << wb.coalesced << "\n"
+            << "write_behind_flushes " << wb.flushes << "\n"
+            << "write_behind_flushed_rows " << wb.flushed_rows << "\n"
+            << "write_behind_failures " << wb.failures << "\n";
+    }
+    if (db_pipeline_)
+    {
+        uint64_t batches = db_pipeline_->batches();
+        double avg_batch = batches ? double(db_pipeline_->batched_queries()) / batches : 0.0;
+        out << "db_pipeline_batches " << batches << "\n"
+            << "db_pipeline_avg_batch " << avg_batch << "\n";
+    }
+
+    if (bitcask_)
+    {
+        Bitcask::Stats bs = bitcask_->stats();
+        out << "bitcask_keys " << bs.keys << "\n"
+            << "bitcask_segments " << bs.segments << "\n"
+            << "bitcask_disk_bytes " << bs.disk_bytes << "\n"
+            << "bitcask_dead_bytes " << bs.dead_bytes << "\n"
+            << "bitcask_syncs " << bs.syncs << "\n"
+            << "bitcask_compactions " << bs.compactions << "\n"
+            << "bitcask_reclaimed_bytes " << bs.reclaimed_bytes << "\n"
+            << "bitcask_corrupt_records " << bs.corrupt_records << "\n";
+    }
+
+    out << "connections " << connections << "\n";
+    return out.str();
+}
+
+void HTTPServer::request_stop()
+{
+    uint64_t one = 1;
+    if (write(stop_fd_, &one, sizeof(one)) < 0) {}
 }
 
 void HTTPServer::stop()
 {
-    running_ = false;
-    if (listen_fd_ >= 0)
+    bool was_running = running_.exchange(false);
+    if (snapshot_thread_.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(snapshot_mtx_);
+            snapshot_stop_ = true;
+        }
+        snapshot_cv_.notify_all();
+        snapshot_thread_.join();
+    }
+    for (auto &r : reactors_)
+    {
+        r->stop();
+    }
+    for (int fd : listen_fds_)
+    {
+        close(fd);
+    }
+    listen_fds_.clear();
+    // statements still out on the async connections will not be answered
+    // now; failing them lets their requests finish (releasing coalesced
+    // waiters and in-flight writes) on the workers drained below
+    for (auto &conns : async_dbs_)
     {
-        close(listen_fd_);
+        for (auto &c : conns)
+            c->abandon();
+    }
+    // the loops have dropped their clients; let the workers finish what is
+    // queued, so no write lands in the cache or write-behind after the
+    // flush below, and no task outlives the objects it uses
+    thread_pool_->shutdown();
+    // acknowledged writes must reach Postgres before the process exits
+    bool flushed = !write_behind_ || write_behind_->stop();
+    // with everything flushed the cache matches the store, for the next
+    // start; with writes lost it holds values the store never got
+    if (!flushed && was_running && !config_.snapshot_path.empty())
+        std::cerr << "Cache snapshot: not written, write-behind flush incomplete\n";
+    else if (was_running && !config_.snapshot_path.empty())
+    {
+        size_t entries = 0;
+        if (take_snapshot(entries))
+            std::cout << "Cache snapshot: " << entries << " entries written to " << config_.snapshot_path << std::endl;
+        else
+            std::cerr << "Cache snapshot: not written\n";
     }
+    // and, unless every write is synced, the embedded log the disk
+    if (bitcask_)
+        bitcask_->close();
 }
\ No newline at end of file
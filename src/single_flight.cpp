@@ -0,0 +1,24 @@
+#include "single_flight.h"
+
+bool SingleFlight::join(const std::string& key, Waiter waiter) {
+    Shard& s = shard_for(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto [it, leader] = s.flights.try_emplace(key);
+    if (leader) return true;
+    it->second.push_back(std::move(waiter));
+    coalesced_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void SingleFlight::finish(const std::string& key, const Result& result) {
+    std::vector<Waiter> waiters;
+    {
+        Shard& s = shard_for(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.flights.find(key);
+        if (it == s.flights.end()) return;
+        waiters.swap(it->second);
+        s.flights.erase(it);
+    }
+    for (auto& w : waiters) w(result);
+}
@@ -0,0 +1,304 @@
+#include "slab_cache.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <sstream>
+
+namespace {
+constexpr size_t kSmallestChunk = 96;
+constexpr double kGrowthFactor = 1.25;
+constexpr size_t kInitialBuckets = 1024;
+}
+
+SlabCache::SlabCache(size_t budget_bytes, size_t num_shards) : budget_bytes_(budget_bytes) {
+    for (size_t size = kSmallestChunk; size < kPageSize / 2;) {
+        class_sizes_.push_back(size);
+        size = (static_cast<size_t>(size * kGrowthFactor) + 7) & ~size_t(7);
+    }
+    class_sizes_.push_back(kPageSize);
+
+    // each shard needs a few pages to be useful
+    size_t n = std::max<size_t>(1, std::min(num_shards, budget_bytes / (4 * kPageSize)));
+    shards_.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        auto s = std::make_unique<Shard>();
+        s->page_limit = std::max<size_t>(1, budget_bytes / n / kPageSize);
+        s->classes.resize(class_sizes_.size());
+        for (size_t c = 0; c < class_sizes_.size(); ++c) s->classes[c].chunk_size = class_sizes_[c];
+        s->buckets.assign(kInitialBuckets, nullptr);
+        s->stats.memory_limit = s->page_limit * kPageSize;
+        shards_.push_back(std::move(s));
+    }
+}
+
+SlabCache::Shard& SlabCache::shard_for(uint64_t hash) {
+    return *shards_[(hash >> 32) % shards_.size()];
+}
+
+int SlabCache::class_for(size_t bytes) const {
+    auto it = std::lower_bound(class_sizes_.begin(), class_sizes_.end(), bytes);
+    if (it == class_sizes_.end()) return -1;
+    return static_cast<int>(it - class_sizes_.begin());
+}
+
+CacheValue SlabCache::get(const std::string& key) {
+    uint64_t h = std::hash<std::string>{}(key);
+    Shard& s = shard_for(h);
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    Item* it = find(s, h, key);
+    if (!it) {
+        s.stats.misses++;
+        return nullptr;
+    }
+    s.stats.hits++;
+    s.hit_copy_bytes += it->value_len;
+    SlabClass& c = s.classes[it->cls];
+    lru_unlink(c, it);
+    lru_push_front(c, it);
+    return std::make_shared<const std::string>(it->value(), it->value_len);
+}
+
+void SlabCache::put(const std::string& key, CacheValue value) {
+    const std::string& bytes = *value;
+    int cls = class_for(sizeof(Item) + key.size() + bytes.size());
+    if (cls < 0 || key.size() > UINT16_MAX) return;   // larger than a page
+
+    uint64_t h = std::hash<std::string>{}(key);
+    Shard& s = shard_for(h);
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    if (Item* old = find(s, h, key)) unlink(s, old);
+
+    Item* it = alloc_chunk(s, cls);
+    if (!it) {
+        // budget spent and this class owns no pages to evict from
+        s.stats.rejected++;
+        return;
+    }
+
+    it->hash = h;
+    it->key_len = static_cast<uint16_t>(key.size());
+    it->value_len = static_cast<uint32_t>(bytes.size());
+    it->cls = static_cast<uint8_t>(cls);
+    std::memcpy(it->key(), key.data(), key.size());
+    std::memcpy(it->value(), bytes.data(), bytes.size());
+
+    Item*& bucket = s.buckets[h & (s.buckets.size() - 1)];
+    it->hash_next = bucket;
+    bucket = it;
+    lru_push_front(s.classes[cls], it);
+
+    if (++s.count > s.buckets.size() * 3 / 2) grow_buckets(s);
+}
+
+void SlabCache::remove(const std::string& key) {
+    uint64_t h = std::hash<std::string>{}(key);
+    Shard& s = shard_for(h);
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    if (Item* it = find(s, h, key)) unlink(s, it);
+}
+
+size_t SlabCache::size() const {
+    size_t total = 0;
+    for (const auto& s : shards_) {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        total += s->count;
+    }
+    return total;
+}
+
+CacheStats SlabCache::stats() const {
+    CacheStats total;
+    for (const auto& s : shards_) {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        CacheStats st = s->stats;
+        st.entries = s->count;
+        st.memory_used = s->pages.size() * kPageSize;
+        total += st;
+    }
+    return total;
+}
+
+std::string SlabCache::engine_report() const {
+    std::vector<SlabClass> sum(class_sizes_.size());
+    uint64_t hit_copy_bytes = 0, page_moves = 0;
+    for (const auto& s : shards_) {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        hit_copy_bytes += s->hit_copy_bytes;
+        page_moves += s->page_moves;
+        for (size_t c = 0; c < sum.size(); ++c) {
+            sum[c].pages += s->classes[c].pages;
+            sum[c].used += s->classes[c].used;
+            sum[c].evictions += s->classes[c].evictions;
+        }
+    }
+
+    std::ostringstream out;
+    out << "slab_hit_copy_bytes " << hit_copy_bytes << "\n"
+        << "slab_page_moves " << page_moves << "\n";
+    for (size_t c = 0; c < sum.size(); ++c) {
+        if (sum[c].pages == 0) continue;
+        size_t chunks = sum[c].pages * (kPageSize / class_sizes_[c]);
+        out << "slab_" << c << "_chunk_size " << class_sizes_[c] << "\n"
+            << "slab_" << c << "_pages " << sum[c].pages << "\n"
+            << "slab_" << c << "_chunks_used " << sum[c].used << "\n"
+            << "slab_" << c << "_chunks_total " << chunks << "\n"
+            << "slab_" << c << "_evictions " << sum[c].evictions << "\n";
+    }
+    return out.str();
+}
+
+void SlabCache::entries(std::vector<Entry>& out) const {
+    for (const auto& s : shards_) {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        for (const SlabClass& c : s->classes) {
+            for (Item* it = c.lru_tail; it; it = it->lru_prev) {
+                out.emplace_back(std::string(it->key(), it->key_len),
+                                 std::make_shared<const std::string>(it->value(), it->value_len));
+            }
+        }
+    }
+}
+
+SlabCache::Item* SlabCache::find(Shard& s, uint64_t hash, const std::string& key) {
+    for (Item* it = s.buckets[hash & (s.buckets.size() - 1)]; it; it = it->hash_next) {
+        if (it->hash == hash && it->key_len == key.size() &&
+            std::memcmp(it->key(), key.data(), key.size()) == 0) {
+            return it;
+        }
+    }
+    return nullptr;
+}
+
+// Free chunk of the class, else a new page if the budget allows, else a
+// page moved over from another class (see move_page), else the class's own
+// LRU tail. A class that owns no pages has nothing to evict, so it asks for
+// a page straight away; otherwise only after a page's worth of evictions.
+SlabCache::Item* SlabCache::alloc_chunk(Shard& s, int cls) {
+    SlabClass& c = s.classes[cls];
+
+    if (!c.free_list && s.pages.size() < s.page_limit) {
+        s.pages.emplace_back(new char[kPageSize]);
+        carve_page(c, s.pages.back().get());
+    }
+
+    if (!c.free_list && (!c.lru_tail || c.recent_evictions >= kPageSize / c.chunk_size))
+        move_page(s, cls);
+
+    if (!c.free_list && c.lru_tail) {
+        unlink(s, c.lru_tail);
+        c.evictions++;
+        c.recent_evictions++;
+        s.stats.evictions++;
+    }
+
+    Item* it = c.free_list;
+    if (!it) return nullptr;
+    c.free_list = it->lru_next;
+    c.used++;
+    return it;
+}
+
+void SlabCache::carve_page(SlabClass& c, char* page) {
+    for (size_t off = 0; off + c.chunk_size <= kPageSize; off += c.chunk_size) {
+        Item* it = reinterpret_cast<Item*>(page + off);
+        it->cls = kFree;
+        it->lru_next = c.free_list;
+        c.free_list = it;
+    }
+    c.pages++;
+}
+
+// Picks the class other than cls that evicted the fewest bytes since the
+// last check and, if that is under half of what cls evicted (or cls owns
+// nothing), evicts every item on the page holding its coldest item and
+// re-carves the page for cls. Either way the eviction counts start over,
+// so a check comes at most once per page turned over.
+bool SlabCache::move_page(Shard& s, int cls) {
+    SlabClass& c = s.classes[cls];
+    size_t pressure = c.recent_evictions * c.chunk_size;
+    int donor = -1;
+    size_t donor_pressure = 0;
+    for (size_t i = 0; i < s.classes.size(); ++i) {
+        const SlabClass& o = s.classes[i];
+        if (static_cast<int>(i) == cls || o.pages == 0) continue;
+        size_t p = o.recent_evictions * o.chunk_size;
+        if (donor < 0 || p < donor_pressure) {
+            donor = static_cast<int>(i);
+            donor_pressure = p;
+        }
+    }
+    for (SlabClass& o : s.classes) o.recent_evictions = 0;
+    if (donor < 0 || (c.lru_tail && donor_pressure * 2 >= pressure)) return false;
+
+    SlabClass& d = s.classes[donor];
+    char* victim = reinterpret_cast<char*>(d.lru_tail ? d.lru_tail : d.free_list);
+    char* page = nullptr;
+    for (const auto& p : s.pages) {
+        if (victim >= p.get() && victim < p.get() + kPageSize) {
+            page = p.get();
+            break;
+        }
+    }
+    for (size_t off = 0; off + d.chunk_size <= kPageSize; off += d.chunk_size) {
+        Item* it = reinterpret_cast<Item*>(page + off);
+        if (it->cls == kFree) continue;
+        unlink(s, it);
+        d.evictions++;
+        s.stats.evictions++;
+    }
+    for (Item** link = &d.free_list; *link;) {
+        char* chunk = reinterpret_cast<char*>(*link);
+        if (chunk >= page && chunk < page + kPageSize) *link = (*link)->lru_next;
+        else link = &(*link)->lru_next;
+    }
+    d.pages--;
+    carve_page(c, page);
+    s.page_moves++;
+    return true;
+}
+
+void SlabCache::unlink(Shard& s, Item* it) {
+    Item** link = &s.buckets[it->hash & (s.buckets.size() - 1)];
+    while (*link != it) link = &(*link)->hash_next;
+    *link = it->hash_next;
+
+    SlabClass& c = s.classes[it->cls];
+    lru_unlink(c, it);
+    it->cls = kFree;
+    it->lru_next = c.free_list;
+    c.free_list = it;
+    c.used--;
+    s.count--;
+}
+
+void SlabCache::lru_push_front(SlabClass& c, Item* it) {
+    it->lru_prev = nullptr;
+    it->lru_next = c.lru_head;
+    if (c.lru_head) c.lru_head->lru_prev = it;
+    c.lru_head = it;
+    if (!c.lru_tail) c.lru_tail = it;
+}
+
+void SlabCache::lru_unlink(SlabClass& c, Item* it) {
+    if (it->lru_prev) it->lru_prev->lru_next = it->lru_next;
+    else c.lru_head = it->lru_next;
+    if (it->lru_next) it->lru_next->lru_prev = it->lru_prev;
+    else c.lru_tail = it->lru_prev;
+}
+
+void SlabCache::grow_buckets(Shard& s) {
+    std::vector<Item*> grown(s.buckets.size() * 2, nullptr);
+    for (Item* head : s.buckets) {
+        while (head) {
+            Item* next = head->hash_next;
+            Item*& bucket = grown[head->hash & (grown.size() - 1)];
+            head->hash_next = bucket;
+            bucket = head;
+            head = next;
+        }
+    }
+    s.buckets.swap(grown);
+}
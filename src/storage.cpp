@@ -0,0 +1,16 @@
+#include "storage.h"
+
+void LatencyTimer::record(uint64_t us) {
+    count.fetch_add(1, std::memory_order_relaxed);
+    total_us.fetch_add(us, std::memory_order_relaxed);
+    uint64_t prev = max_us.load(std::memory_order_relaxed);
+    while (us > prev && !max_us.compare_exchange_weak(prev, us, std::memory_order_relaxed)) {}
+}
+
+QueryStats LatencyTimer::load() const {
+    QueryStats q;
+    q.count = count.load(std::memory_order_relaxed);
+    q.total_us = total_us.load(std::memory_order_relaxed);
+    q.max_us = max_us.load(std::memory_order_relaxed);
+    return q;
+}
@@ -1,13 +1,166 @@
 #include "threadpool.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr int kSpinRounds = 64;
+
+// worker index of the calling thread in the pool it belongs to, if any
+thread_local const void* tl_pool = nullptr;
+thread_local size_t tl_worker = 0;
+
+void cpu_relax() {
+#ifdef __SSE2__
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+} // namespace
+
+// ---------------------------- Deque ----------------------------
+
+void ThreadPool::Deque::store(int64_t i, const Task& t) {
+    uint64_t words[kWords];
+    std::memcpy(words, &t, sizeof(Task));
+    Slot& s = slots_[i & (kCapacity - 1)];
+    for (size_t k = 0; k < kWords; ++k) s.w[k].store(words[k], std::memory_order_relaxed);
+}
+
+Task ThreadPool::Deque::load(int64_t i) const {
+    uint64_t words[kWords];
+    const Slot& s = slots_[i & (kCapacity - 1)];
+    for (size_t k = 0; k < kWords; ++k) words[k] = s.w[k].load(std::memory_order_relaxed);
+    Task t;
+    std::memcpy(&t, words, sizeof(Task));
+    return t;
+}
+
+bool ThreadPool::Deque::push(const Task& t) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t top = top_.load(std::memory_order_acquire);
+    if (b - top >= kCapacity) return false;
+    store(b, t);
+    bottom_.store(b + 1, std::memory_order_release);
+    return true;
+}
+
+bool ThreadPool::Deque::pop(Task& t) {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(b, std::memory_order_seq_cst);
+    int64_t top = top_.load(std::memory_order_seq_cst);
+
+    if (top > b) {
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+    t = load(b);
+    if (top == b) {
+        // last task: race the thieves for it
+        bool won = top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                                std::memory_order_relaxed);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+bool ThreadPool::Deque::steal(Task& t) {
+    int64_t top = top_.load(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_seq_cst);
+    if (top >= b) return false;
+
+    Task candidate = load(top);
+    if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+        return false;   // the owner or another thief got it
+    }
+    t = candidate;
+    return true;
+}
+
+size_t ThreadPool::Deque::size() const {
+    int64_t n = bottom_.load(std::memory_order_relaxed) - top_.load(std::memory_order_relaxed);
+    return n > 0 ? static_cast<size_t>(n) : 0;
+}
+
+// ---------------------------- InjectQueue ----------------------------
+
+ThreadPool::InjectQueue::InjectQueue() : cells_(new Cell[kCapacity]) {
+    for (size_t i = 0; i < kCapacity; ++i) cells_[i].seq.store(i, std::memory_order_relaxed);
+}
+
+bool ThreadPool::InjectQueue::push(const Task& t) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    while (true) {
+        Cell& c = cells_[pos & (kCapacity - 1)];
+        size_t seq = c.seq.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (diff == 0) {
+            if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                c.task = t;
+                c.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;   // full
+        } else {
+            pos = tail_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool ThreadPool::InjectQueue::pop(Task& t) {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    while (true) {
+        Cell& c = cells_[pos & (kCapacity - 1)];
+        size_t seq = c.seq.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+        if (diff == 0) {
+            if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                t = c.task;
+                c.seq.store(pos + kCapacity, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;   // empty
+        } else {
+            pos = head_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+size_t ThreadPool::InjectQueue::size() const {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+// ---------------------------- ThreadPool ----------------------------
 
 ThreadPool::ThreadPool(size_t num_threads) {
+    if (num_threads == 0) num_threads = 1;
+    for (size_t i = 0; i < num_threads; ++i) {
+        queues_.push_back(std::make_unique<Worker>());
+    }
     for (size_t i = 0; i < num_threads; ++i) {
-        workers_.emplace_back(&ThreadPool::worker_loop, this);
+        workers_.emplace_back(&ThreadPool::worker_loop, this, i);
     }
 }
 
 ThreadPool::~ThreadPool() {
+    shutdown();
+}
+
+void ThreadPool::shutdown() {
     stopping_ = true;
+    {
+        std::lock_guard<std::mutex> lock(park_mutex_);
+        wake_epoch_.fetch_add(1);
+    }
     cv_.notify_all();
     for (auto& worker : workers_) {
         if (worker.joinable()) {
@@ -16,33 +169,95 @@ ThreadPool::~ThreadPool() {
     }
 }
 
-void ThreadPool::enqueue(std::function<void()> task) {
+// Workers push onto their own deque; everyone else, or a worker whose
+// deque is full, goes through the injection queue. If that is full too the
+// pool is hopelessly behind and the submitter waits for room.
+void ThreadPool::enqueue(Task task) {
+    bool queued = false;
+    if (tl_pool == this) {
+        queued = queues_[tl_worker]->deque.push(task);
+    }
+    if (!queued) {
+        while (!inject_.push(task)) std::this_thread::yield();
+        injected_.fetch_add(1, std::memory_order_relaxed);
+    }
+    wake_one();
+}
+
+// Pairs with the sleepers_ increment in worker_loop: either this load sees
+// the sleeper, or the sleeper's re-check sees the task just queued.
+void ThreadPool::wake_one() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers_.load(std::memory_order_relaxed) == 0) return;
     {
-        std::unique_lock<std::mutex> lock(queue_mutex_);
-        tasks_.push(std::move(task));
+        std::lock_guard<std::mutex> lock(park_mutex_);
+        wake_epoch_.fetch_add(1, std::memory_order_relaxed);
     }
     cv_.notify_one();
 }
 
-void ThreadPool::worker_loop() {
-    while (true) {
-        std::function<void()> task;
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex_);
-            cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+// Own deque first, then the injection queue, then the other workers'
+// deques starting from the next one along.
+bool ThreadPool::find_task(size_t index, Task& t) {
+    Worker& self = *queues_[index];
+    if (self.deque.pop(t)) return true;
+    if (inject_.pop(t)) return true;
+    for (size_t i = 1; i < queues_.size(); ++i) {
+        Worker& victim = *queues_[(index + i) % queues_.size()];
+        if (victim.deque.steal(t)) {
+            self.steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
 
-            if (stopping_ && tasks_.empty()) {
-                break;
-            }
+void ThreadPool::worker_loop(size_t index) {
+    tl_pool = this;
+    tl_worker = index;
+    Worker& self = *queues_[index];
 
-            if (!tasks_.empty()) {
-                task = std::move(tasks_.front());
-                tasks_.pop();
-            }
+    while (true) {
+        Task task;
+        bool found = false;
+        for (int spin = 0; spin < kSpinRounds && !found; ++spin) {
+            found = find_task(index, task);
+            if (!found) cpu_relax();
         }
 
-        if (task) {
-            task();
+        if (!found) {
+            sleepers_.fetch_add(1, std::memory_order_seq_cst);
+            uint64_t epoch = wake_epoch_.load(std::memory_order_seq_cst);
+            found = find_task(index, task);
+            if (!found) {
+                if (stopping_) {
+                    sleepers_.fetch_sub(1);
+                    break;
+                }
+                self.parks.fetch_add(1, std::memory_order_relaxed);
+                std::unique_lock<std::mutex> lock(park_mutex_);
+                cv_.wait(lock, [&] {
+                    return wake_epoch_.load(std::memory_order_relaxed) != epoch || stopping_;
+                });
+            }
+            sleepers_.fetch_sub(1);
+            if (!found) continue;
         }
+
+        task();
+        self.executed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+ThreadPoolStats ThreadPool::stats() const {
+    ThreadPoolStats s;
+    s.injected = injected_.load(std::memory_order_relaxed);
+    s.queue_depth = inject_.size();
+    for (const auto& w : queues_) {
+        s.executed += w->executed.load(std::memory_order_relaxed);
+        s.steals += w->steals.load(std::memory_order_relaxed);
+        s.parks += w->parks.load(std::memory_order_relaxed);
+        s.queue_depth += w->deque.size();
     }
+    return s;
 }
@@ -0,0 +1,177 @@
+#include "write_behind.h"
+#include <vector>
+#include <iostream>
+
+namespace {
+// PUTs start to wait once this many batches are pending
+constexpr size_t kMaxPendingBatches = 64;
+// Postgres accepts at most 65535 bind parameters, two per upserted row
+constexpr size_t kMaxRowsPerStatement = 30000;
+// retries of the final flush back off from here, doubling up to the max
+constexpr auto kDrainRetryMin = std::chrono::milliseconds(50);
+constexpr auto kDrainRetryMax = std::chrono::milliseconds(2000);
+}
+
+WriteBehind::WriteBehind(std::unique_ptr<Storage> store, std::chrono::milliseconds interval,
+                         size_t max_batch, std::chrono::milliseconds drain_timeout)
+    : db_(std::move(store)),
+      interval_(interval),
+      drain_timeout_(drain_timeout),
+      max_batch_(std::min(std::max<size_t>(1, max_batch), kMaxRowsPerStatement)),
+      max_dirty_(max_batch_ * kMaxPendingBatches) {
+    if (!db_->connect()) {
+        std::cerr << "Write-behind: failed to connect\n";
+        return;
+    }
+    connected_ = true;
+    flusher_ = std::thread(&WriteBehind::flusher_loop, this);
+}
+
+WriteBehind::~WriteBehind() {
+    stop();
+}
+
+void WriteBehind::write(const std::string& key, CacheValue value) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    room_cv_.wait(lock, [&] { return stopping_ || dirty_.size() < max_dirty_ || dirty_.count(key); });
+
+    auto [it, inserted] = dirty_.try_emplace(key);
+    it->second.value = std::move(value);
+    it->second.seq = ++next_seq_;
+    stats_.writes++;
+    if (!inserted) stats_.coalesced++;
+    if (dirty_.size() >= max_batch_) flush_cv_.notify_one();
+}
+
+WriteBehind::Lookup WriteBehind::lookup(const std::string& key, CacheValue& value) const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = dirty_.find(key);
+    if (it == dirty_.end()) return Lookup::Absent;
+    value = it->second.value;
+    return value ? Lookup::Found : Lookup::Deleted;
+}
+
+std::map<std::string, CacheValue> WriteBehind::pending(const std::string& prefix,
+                                                      const std::string& start) const {
+    std::map<std::string, CacheValue> out;
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (const auto& kv : dirty_) {
+        if (kv.first >= start && kv.first.compare(0, prefix.size(), prefix) == 0)
+            out.emplace(kv.first, kv.second.value);
+    }
+    return out;
+}
+
+uint64_t WriteBehind::version() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return next_seq_;
+}
+
+// A newer write is either still dirty or was flushed; a flushed one no
+// longer says which key it was for.
+bool WriteBehind::written_since(const std::string& key, uint64_t since) const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (flushed_seq_ > since) return true;
+    auto it = dirty_.find(key);
+    return it != dirty_.end() && it->second.seq > since;
+}
+
+bool WriteBehind::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!stopping_) {
+            stopping_ = true;
+            drain_deadline_ = std::chrono::steady_clock::now() + drain_timeout_;
+        }
+    }
+    flush_cv_.notify_one();
+    room_cv_.notify_all();
+    if (flusher_.joinable()) flusher_.join();
+    std::lock_guard<std::mutex> lock(mtx_);
+    return dirty_.empty();
+}
+
+WriteBehind::Stats WriteBehind::stats() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    Stats s = stats_;
+    s.dirty = dirty_.size();
+    return s;
+}
+
+void WriteBehind::flusher_loop() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (true) {
+        flush_cv_.wait_for(lock, interval_, [&] { return stopping_ || dirty_.size() >= max_batch_; });
+
+        // one batch per wake-up, then more back to back while full batches
+        // are waiting (or, when stopping, until nothing is left)
+        bool ok;
+        do {
+            lock.unlock();
+            ok = flush_batch();
+            lock.lock();
+        } while (ok && (dirty_.size() >= max_batch_ || (stopping_ && !dirty_.empty())));
+
+        if (stopping_) break;
+    }
+
+    // the last flush failed: keep trying until the store comes back or the
+    // deadline passes
+    auto backoff = kDrainRetryMin;
+    while (!dirty_.empty()) {
+        auto left = drain_deadline_ - std::chrono::steady_clock::now();
+        if (left <= left.zero()) {
+            std::cerr << "Write-behind: dropping " << dirty_.size() << " unflushed writes\n";
+            return;
+        }
+        std::cerr << "Write-behind: flush failed, " << dirty_.size() << " writes pending; retrying\n";
+        lock.unlock();
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(backoff, left));
+        bool ok;
+        do {
+            ok = flush_batch();
+        } while (ok);
+        lock.lock();
+        backoff = std::min(backoff * 2, kDrainRetryMax);
+    }
+}
+
+// Copies up to max_batch_ entries out under the lock, writes them without
+// it, then drops the ones not rewritten in the meantime.
+bool WriteBehind::flush_batch() {
+    std::vector<std::pair<std::string, Dirty>> batch;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (dirty_.empty()) return false;
+        batch.reserve(std::min(dirty_.size(), max_batch_));
+        for (const auto& kv : dirty_) {
+            batch.emplace_back(kv.first, kv.second);
+            if (batch.size() == max_batch_) break;
+        }
+    }
+
+    std::vector<Storage::KeyValue> upserts;
+    std::vector<const std::string*> deletes;
+    for (const auto& e : batch) {
+        if (e.second.value) upserts.emplace_back(&e.first, e.second.value.get());
+        else deletes.push_back(&e.first);
+    }
+    bool ok = db_->write_batch(upserts, deletes);
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (!ok) {
+        stats_.failures++;
+        return false;
+    }
+    for (const auto& e : batch) {
+        auto it = dirty_.find(e.first);
+        if (it != dirty_.end() && it->second.seq == e.second.seq) {
+            flushed_seq_ = std::max(flushed_seq_, e.second.seq);
+            dirty_.erase(it);
+        }
+    }
+    stats_.flushes++;
+    stats_.flushed_rows += batch.size();
+    room_cv_.notify_all();
+    return true;
+}
@@ -0,0 +1,82 @@
+// Frame validation in binproto::parse and binproto::parse_keys.
+// Build and run with `make test`.
+#include "binary_protocol.h"
+#include <iostream>
+#include <string>
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    if (!ok) {
+        std::cerr << "FAIL: " << what << "\n";
+        failures++;
+    }
+}
+
+void put_u16(std::string& out, size_t v) {
+    out += char(v >> 8);
+    out += char(v);
+}
+
+std::string frame(binproto::Op op, const std::string& key, const std::string& body) {
+    std::string out(1, static_cast<char>(op));
+    put_u16(out, key.size());
+    binproto::append_u32(out, static_cast<uint32_t>(body.size()));
+    return out + key + body;
+}
+
+binproto::ParseStatus parse(const std::string& data) {
+    binproto::Frame f;
+    return binproto::parse(data.data(), data.size(), f);
+}
+
+} // namespace
+
+int main() {
+    using binproto::Op;
+    using binproto::ParseStatus;
+
+    std::string set = frame(Op::Set, "key_1", "value");
+    binproto::Frame f;
+    check(binproto::parse(set.data(), set.size(), f) == ParseStatus::Done, "well-formed SET parses");
+    check(f.key == "key_1" && f.body == "value" && f.size == set.size(), "SET frame fields");
+    check(parse(set.substr(0, set.size() - 1)) == ParseStatus::Incomplete, "truncated frame is incomplete");
+
+    check(parse(frame(Op::Get, std::string(binproto::kMaxKeyBytes, 'k'), "")) == ParseStatus::Done,
+          "255-byte key parses");
+    check(parse(frame(Op::Get, std::string(binproto::kMaxKeyBytes + 1, 'k'), "")) == ParseStatus::Error,
+          "256-byte key is rejected");
+    // rejected from the header alone, before the key has arrived
+    check(parse(frame(Op::Get, std::string(300, 'k'), "").substr(0, binproto::kRequestHeader)) ==
+              ParseStatus::Error,
+          "oversized key length is rejected from the header");
+
+    check(parse(frame(Op::Set, std::string("a\0b", 3), "v")) == ParseStatus::Error,
+          "key with NUL is rejected");
+    check(parse(frame(Op::Set, "a", std::string("v\0w", 3))) == ParseStatus::Done,
+          "NUL in a value is fine");
+
+    std::string keys;
+    put_u16(keys, 1);
+    keys += "a";
+    std::vector<std::string> out;
+    check(binproto::parse_keys(keys, out) && out.size() == 1 && out[0] == "a", "MGET body parses");
+
+    std::string nul_keys = keys;
+    put_u16(nul_keys, 3);
+    nul_keys += std::string("b\0c", 3);
+    out.clear();
+    check(!binproto::parse_keys(nul_keys, out), "MGET key with NUL is rejected");
+
+    std::string long_keys = keys;
+    put_u16(long_keys, binproto::kMaxKeyBytes + 1);
+    long_keys += std::string(binproto::kMaxKeyBytes + 1, 'k');
+    out.clear();
+    check(!binproto::parse_keys(long_keys, out), "MGET key over 255 bytes is rejected");
+
+    if (failures) return 1;
+    std::cout << "binary_protocol_test: ok\n";
+    return 0;
+}